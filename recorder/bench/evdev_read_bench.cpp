@@ -0,0 +1,326 @@
+// Compares the evdev backend's read path with one libevdev_next_event() call
+// per event. A virtual keyboard is created through uinput and fed key frames
+// as fast as they are taken in. Needs write access to /dev/uinput.
+//
+// - libevdev: drains the node one libevdev_next_event() call at a time and
+//   turns key frames into Inputs appended to an InputStore, like the backend
+//   did before it read events in batches
+// - backend: a Recorder on the evdev backend captures the device, through the
+//   same batched reads, filtering and frame decoding as a real recording
+//
+// The writer keeps up to --window frames in flight. It never waits for the
+// reader to drain a burst, so the rates are sustained throughput of the read
+// side, bounded by the kernel's per-client buffer the window has to fit in.
+// CPU time is that of the whole process minus the writer thread.
+#include <recorder.h>
+#include <input_store.h>
+#include <libevdev/libevdev.h>
+#include <libevdev/libevdev-uinput.h>
+#include <boost/program_options.hpp>
+#include <spdlog/spdlog.h>
+
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <print>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/input.h>
+
+namespace po = boost::program_options;
+using namespace std::literals;
+
+struct BenchResult {
+    std::uint64_t Frames = 0;
+    std::uint64_t Drops = 0;
+    std::chrono::nanoseconds Wall{};
+    // Of the read side only
+    std::chrono::nanoseconds Cpu{};
+};
+
+static std::chrono::nanoseconds cpu_time(clockid_t clock)
+{
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+// The backend only records keyboards that have BTN_A, KEY_A is what's typed
+class VirtualKeyboard
+{
+public:
+    VirtualKeyboard()
+    {
+        m_device = libevdev_new();
+        libevdev_set_name(m_device, "recorder evdev read benchmark");
+        libevdev_enable_event_type(m_device, EV_KEY);
+        libevdev_enable_event_code(m_device, EV_KEY, KEY_A, nullptr);
+        libevdev_enable_event_code(m_device, EV_KEY, BTN_A, nullptr);
+        if (int err = libevdev_uinput_create_from_device(m_device, LIBEVDEV_UINPUT_OPEN_MANAGED, &m_uinput); err != 0)
+        {
+            libevdev_free(m_device);
+            throw std::runtime_error(std::format("Failed to create the uinput device: {}", std::strerror(-err)));
+        }
+    }
+    ~VirtualKeyboard()
+    {
+        libevdev_uinput_destroy(m_uinput);
+        libevdev_free(m_device);
+    }
+    VirtualKeyboard(const VirtualKeyboard&) = delete;
+    VirtualKeyboard& operator=(const VirtualKeyboard&) = delete;
+
+    const char* DevNode() const
+    {
+        return libevdev_uinput_get_devnode(m_uinput);
+    }
+    // A key change and its SYN_REPORT, two events and one Input
+    void WriteFrame(bool pressed)
+    {
+        libevdev_uinput_write_event(m_uinput, EV_KEY, KEY_A, pressed);
+        libevdev_uinput_write_event(m_uinput, EV_SYN, SYN_REPORT, 0);
+    }
+
+private:
+    libevdev* m_device = nullptr;
+    libevdev_uinput* m_uinput = nullptr;
+};
+
+// Key changes are held until their SYN_REPORT, like the backend does
+struct LibevdevReader
+{
+    libevdev* device = nullptr;
+    InputStore inputs;
+    std::vector<Input> frame;
+    std::uint32_t frame_index = 0;
+    std::uint64_t drops = 0;
+
+    void Drain()
+    {
+        input_event event;
+        int rc;
+        while ((rc = libevdev_next_event(device, LIBEVDEV_READ_FLAG_NORMAL, &event)) >= 0)
+        {
+            if (rc == LIBEVDEV_READ_STATUS_SYNC)
+            {
+                ++drops;
+                frame.clear();
+                while (libevdev_next_event(device, LIBEVDEV_READ_FLAG_SYNC, &event) == LIBEVDEV_READ_STATUS_SYNC)
+                    ;
+                continue;
+            }
+            std::uint64_t timestamp = event.input_event_sec * 1000000ULL + event.input_event_usec;
+            if (event.type == EV_SYN && event.code == SYN_REPORT)
+            {
+                ++frame_index;
+                for (auto& input: frame)
+                    input.Frame = frame_index;
+                inputs.append(frame);
+                frame.clear();
+            }
+            else if (event.type == EV_KEY && event.value != 2)
+            {
+                frame.push_back(Input{
+                    .Timestamp = timestamp,
+                    .Pressed = event.value != 0,
+                    .Code = static_cast<Keycode>(event.code)
+                });
+            }
+        }
+    }
+};
+
+// Writes frames while fewer than window are waiting to be taken in, consumed()
+// counts the ones that were
+static void write_sustained(
+    VirtualKeyboard& keyboard, std::uint64_t frames, std::uint64_t window,
+    const std::function<std::uint64_t()>& consumed, const std::atomic<bool>& dropped
+)
+{
+    for (std::uint64_t written = 0; written < frames && !dropped.load(std::memory_order_relaxed);)
+    {
+        auto in_flight = written - consumed();
+        if (in_flight >= window)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        for (auto n = window - in_flight; n > 0 && written < frames; --n, ++written)
+            keyboard.WriteFrame(written % 2 == 0);
+    }
+}
+
+static BenchResult run_libevdev(std::uint64_t frames, std::uint64_t window)
+{
+    VirtualKeyboard keyboard;
+    // give udev a moment to set up the node before it's opened
+    std::this_thread::sleep_for(200ms);
+    int fd = open(keyboard.DevNode(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error(std::format("Failed to open {}: {}", keyboard.DevNode(), std::strerror(errno)));
+    LibevdevReader reader;
+    if (int err = libevdev_new_from_fd(fd, &reader.device); err != 0)
+    {
+        close(fd);
+        throw std::runtime_error(std::format("Failed to init libevdev: {}", std::strerror(-err)));
+    }
+
+    std::atomic<bool> dropped = false;
+    std::atomic<bool> done = false;
+    std::jthread reader_thread([&]() {
+        pollfd poll_fd{ .fd = fd, .events = POLLIN, .revents = 0 };
+        while (!done.load(std::memory_order_relaxed))
+        {
+            if (poll(&poll_fd, 1, 100) <= 0)
+                continue;
+            reader.Drain();
+            if (reader.drops)
+                dropped.store(true, std::memory_order_relaxed);
+        }
+    });
+
+    auto cpu_start = cpu_time(CLOCK_PROCESS_CPUTIME_ID);
+    auto writer_start = cpu_time(CLOCK_THREAD_CPUTIME_ID);
+    auto start = std::chrono::steady_clock::now();
+    write_sustained(keyboard, frames, window, [&]() { return reader.inputs.size(); }, dropped);
+    while (reader.inputs.size() < frames && !dropped.load(std::memory_order_relaxed))
+        std::this_thread::yield();
+    BenchResult result;
+    result.Wall = std::chrono::steady_clock::now() - start;
+    result.Cpu = cpu_time(CLOCK_PROCESS_CPUTIME_ID) - cpu_start - (cpu_time(CLOCK_THREAD_CPUTIME_ID) - writer_start);
+    done = true;
+    reader_thread.join();
+    result.Frames = reader.inputs.size();
+    result.Drops = reader.drops;
+
+    libevdev_free(reader.device);
+    close(fd);
+    return result;
+}
+
+static BenchResult run_backend(std::uint64_t frames, std::uint64_t window)
+{
+    VirtualKeyboard keyboard;
+    std::this_thread::sleep_for(200ms);
+    // no sinks, the backend's logging is not what's measured
+    auto logger = std::make_shared<spdlog::logger>("bench");
+    Recorder recorder(RecorderBackend::LINUX_EVDEV, logger);
+    // drops show up in Overflows() after the fact, the writer doesn't stop on them
+    std::atomic<bool> dropped = false;
+    recorder.Start(true, false, false);
+    // the setup thread opens the devices that are already there
+    std::this_thread::sleep_for(500ms);
+    // other keyboards typed on meanwhile would be counted too
+    auto base = recorder.InputCount();
+
+    auto cpu_start = cpu_time(CLOCK_PROCESS_CPUTIME_ID);
+    auto writer_start = cpu_time(CLOCK_THREAD_CPUTIME_ID);
+    auto start = std::chrono::steady_clock::now();
+    auto consumed = [&]() { return recorder.InputCount() - base; };
+    write_sustained(keyboard, frames, window, consumed, dropped);
+    // lost inputs never come, give up once nothing came in for a second
+    auto last = consumed();
+    auto last_change = std::chrono::steady_clock::now();
+    while (last < frames && std::chrono::steady_clock::now() - last_change < 1s)
+    {
+        std::this_thread::yield();
+        if (auto now = consumed(); now != last)
+        {
+            last = now;
+            last_change = std::chrono::steady_clock::now();
+        }
+    }
+    BenchResult result;
+    result.Wall = std::chrono::steady_clock::now() - start;
+    result.Cpu = cpu_time(CLOCK_PROCESS_CPUTIME_ID) - cpu_start - (cpu_time(CLOCK_THREAD_CPUTIME_ID) - writer_start);
+    recorder.Stop();
+    result.Frames = consumed();
+    recorder.Overflows().cvisit_all([&](const Recorder::OverflowMap::value_type& entry) {
+        result.Drops += entry.second.Drops;
+    });
+    return result;
+}
+
+static void print_result(std::string_view name, const BenchResult& result)
+{
+    auto seconds = std::chrono::duration<double>(result.Wall).count();
+    // every frame is a key event and a SYN_REPORT
+    auto events = result.Frames * 2;
+    std::println(
+        "{:<9} {:>10} events  {:>12.0f} events/s  {:>8.1f} ns CPU/event  {} drops",
+        name, events,
+        seconds > 0 ? events / seconds : 0.0,
+        events ? static_cast<double>(result.Cpu.count()) / events : 0.0,
+        result.Drops
+    );
+}
+
+int main(int argc, char const *argv[])
+{
+    std::uint64_t frames;
+    std::uint64_t window;
+    unsigned rounds;
+    po::options_description desc("Allowed options");
+    desc.add_options()
+        ("help", "produce help message")
+        (
+            "frames",
+            po::value<std::uint64_t>(&frames)->default_value(500000),
+            "Key frames written per round, each is a key event and a SYN_REPORT"
+        )
+        (
+            "window",
+            po::value<std::uint64_t>(&window)->default_value(24),
+            "Frames written but not yet taken in by the reader, at most. Twice this "
+            "must fit in the kernel's buffer of the client, 64 events for this device"
+        )
+        (
+            "rounds",
+            po::value<unsigned>(&rounds)->default_value(3),
+            "Rounds per read path, they alternate between the paths"
+        );
+    po::variables_map vm;
+
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    }
+    catch (const std::exception& e) {
+        std::println("Error: {}", e.what());
+        return 1;
+    }
+    if (vm.count("help")) {
+        std::cout << desc << "\n";
+        return 0;
+    }
+    if (window == 0) {
+        std::println("Error: --window must be at least 1");
+        return 1;
+    }
+
+    try {
+        for (unsigned round = 0; round < rounds; ++round) {
+            print_result("libevdev", run_libevdev(frames, window));
+            print_result("backend", run_backend(frames, window));
+        }
+    }
+    catch (const std::exception& e) {
+        std::println("Error: {}", e.what());
+        return 1;
+    }
+    return 0;
+}
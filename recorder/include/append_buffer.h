@@ -0,0 +1,192 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <span>
+
+// Append-only storage written by a single thread, while any number of
+// others read what has been published so far. Neither side takes a lock.
+// Elements live in fixed-size chunks that are never moved, so growing never
+// copies and references stay valid until clear().
+template <typename T, std::size_t ChunkSize = 1024>
+class AppendBuffer
+{
+    struct Chunk
+    {
+        std::array<T, ChunkSize> items;
+        std::atomic<Chunk*> next = nullptr;
+    };
+
+public:
+    using value_type = T;
+    using size_type = std::size_t;
+
+    // Walks the elements published when it was created, later appends don't
+    // show up. A default constructed iterator is the end of every walk.
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const T*;
+        using reference = const T&;
+
+        const_iterator() = default;
+
+        reference operator*() const
+        {
+            return m_chunk->items[m_index % ChunkSize];
+        }
+        pointer operator->() const
+        {
+            return &**this;
+        }
+        const_iterator& operator++()
+        {
+            ++m_index;
+            if (m_index % ChunkSize == 0)
+            {
+                // the next chunk may not exist yet, refresh() moves on to it
+                if (m_index < m_size)
+                    m_chunk = m_chunk->next.load(std::memory_order_relaxed);
+                else
+                    m_behind = true;
+            }
+            return *this;
+        }
+        const_iterator operator++(int)
+        {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+        bool operator==(const const_iterator& other) const
+        {
+            if (_at_end() || other._at_end())
+                return _at_end() == other._at_end();
+            return m_index == other.m_index;
+        }
+
+    private:
+        friend class AppendBuffer;
+        const_iterator(const Chunk* chunk, std::size_t size): m_chunk(chunk), m_size(size) {}
+        bool _at_end() const
+        {
+            return m_index >= m_size;
+        }
+
+        const Chunk* m_chunk = nullptr;
+        std::size_t m_index = 0;
+        std::size_t m_size = 0;
+        bool m_behind = false;
+    };
+
+    AppendBuffer() = default;
+    ~AppendBuffer()
+    {
+        clear();
+    }
+    AppendBuffer(const AppendBuffer&) = delete;
+    AppendBuffer& operator=(const AppendBuffer&) = delete;
+
+    // Writer only
+    void push_back(const T& value)
+    {
+        auto size = m_size.load(std::memory_order_relaxed);
+        auto offset = size % ChunkSize;
+        if (offset == 0)
+            _grow();
+        m_tail->items[offset] = value;
+        // publishes the element, and the chunk it went into
+        m_size.store(size + 1, std::memory_order_release);
+    }
+    // Writer only, the values are published together
+    void append(std::span<const T> values)
+    {
+        auto size = m_size.load(std::memory_order_relaxed);
+        for (auto& value: values)
+        {
+            auto offset = size % ChunkSize;
+            if (offset == 0)
+                _grow();
+            m_tail->items[offset] = value;
+            ++size;
+        }
+        m_size.store(size, std::memory_order_release);
+    }
+
+    // Neither the writer nor any reader may be active
+    void clear()
+    {
+        auto chunk = m_head.load(std::memory_order_relaxed);
+        while (chunk)
+        {
+            auto next = chunk->next.load(std::memory_order_relaxed);
+            delete chunk;
+            chunk = next;
+        }
+        m_head.store(nullptr, std::memory_order_relaxed);
+        m_tail = nullptr;
+        m_size.store(0, std::memory_order_relaxed);
+    }
+
+    std::size_t size() const
+    {
+        return m_size.load(std::memory_order_acquire);
+    }
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    const_iterator begin() const
+    {
+        // the size is read first, its acquire makes the chunks it covers visible
+        auto size = m_size.load(std::memory_order_acquire);
+        return const_iterator(m_head.load(std::memory_order_relaxed), size);
+    }
+    const_iterator end() const
+    {
+        return {};
+    }
+    // Lets an iterator walk on into what has been appended since it was created
+    void refresh(const_iterator& it) const
+    {
+        it.m_size = m_size.load(std::memory_order_acquire);
+        if (it.m_index >= it.m_size)
+            return;
+        if (!it.m_chunk)
+            it.m_chunk = m_head.load(std::memory_order_relaxed);
+        else if (it.m_behind)
+            it.m_chunk = it.m_chunk->next.load(std::memory_order_relaxed);
+        it.m_behind = false;
+    }
+
+    // Walks the chunks, index must be below a size() read before
+    const T& operator[](std::size_t index) const
+    {
+        auto chunk = m_head.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < index / ChunkSize; ++i)
+            chunk = chunk->next.load(std::memory_order_relaxed);
+        return chunk->items[index % ChunkSize];
+    }
+
+private:
+    void _grow()
+    {
+        auto chunk = new Chunk;
+        if (m_tail)
+            m_tail->next.store(chunk, std::memory_order_relaxed);
+        else
+            m_head.store(chunk, std::memory_order_relaxed);
+        m_tail = chunk;
+    }
+
+    std::atomic<Chunk*> m_head = nullptr;
+    // Only touched by the writer
+    Chunk* m_tail = nullptr;
+    std::atomic<std::size_t> m_size = 0;
+};
@@ -20,9 +20,14 @@ struct UsbDeviceInfo {
     std::vector<unsigned char> Descriptors;
 };
 
+// Stands in for a device ID on the hot path. Handles count from 0 in the
+// order devices show up, and are only valid for one recording.
+using DeviceHandle = std::uint32_t;
+
 struct Device {
     std::string Name;
     std::uint16_t VID;
     std::uint16_t PID;
     std::optional<std::string> UsbDeviceId;
+    DeviceHandle Handle = 0;
 };
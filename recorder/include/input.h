@@ -0,0 +1,33 @@
+#pragma once
+
+#include <keycode.h>
+#include <cstdint>
+#include <optional>
+
+enum class InputKind : std::uint8_t {
+    KEY,
+    // Relative mouse motion, Pressed and Code are unused
+    MOTION
+};
+
+struct Input {
+    std::uint64_t Timestamp;
+    bool Pressed;
+    Keycode Code;
+    // Sequence number of the device report (evdev SYN_REPORT frame) the input
+    // came in, inputs sharing it arrived in the same poll. Counts from 1 per
+    // device, 0 if the backend doesn't know about reports.
+    std::uint32_t Frame = 0;
+    // The device's own clock in microseconds, for devices that report one.
+    // It has its own epoch, only the differences between inputs are meaningful.
+    std::optional<std::uint64_t> DeviceTimestamp;
+    // Host time the input was read at, on the same clock as Timestamp, which
+    // is the kernel's. Only recorded in busy poll mode.
+    std::optional<std::uint64_t> ReceiveTimestamp;
+    InputKind Kind = InputKind::KEY;
+    // Motion inputs only. Coalesced motion sums up several reports, Timestamp
+    // and Frame are then those of the last one.
+    std::int32_t DX = 0;
+    std::int32_t DY = 0;
+    std::uint32_t Reports = 0;
+};
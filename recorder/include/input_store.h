@@ -0,0 +1,447 @@
+#pragma once
+
+#include <input.h>
+#include <keycode.h>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+
+// The inputs of one device, stored column by column. Has the same single
+// writer, lock-free reader contract as AppendBuffer, but an input takes 11
+// bytes instead of the 64 of Input:
+// - timestamps are 32-bit offsets from the first timestamp of their chunk
+// - the keycode and the pressed bit share 16 bits
+// - device and receive timestamps and motion only get columns in the chunks
+//   that have them
+// Chunks start small and double up to max_chunk_size, so a device that only
+// sent a few inputs doesn't hold a full chunk. Inputs are decoded back into
+// Input when iterated, scans that only need some columns go through
+// visit_columns() instead.
+class InputStore
+{
+public:
+    static constexpr std::size_t first_chunk_size = 64;
+    static constexpr std::size_t max_chunk_size = 4096;
+
+    // Per input flags
+    static constexpr std::uint8_t wide_timestamp = 1 << 0;
+    static constexpr std::uint8_t has_device_timestamp = 1 << 1;
+    static constexpr std::uint8_t has_receive_timestamp = 1 << 2;
+    static constexpr std::uint8_t motion = 1 << 3;
+
+private:
+    static_assert(static_cast<unsigned>(Keycode::HatW) < 0x8000, "keycodes must fit in 15 bits");
+    static constexpr std::uint16_t pressed_bit = 0x8000;
+
+    struct Motion
+    {
+        std::int32_t dx;
+        std::int32_t dy;
+        std::uint32_t reports;
+    };
+
+    struct Chunk
+    {
+        explicit Chunk(std::size_t capacity, std::uint64_t base_timestamp):
+            capacity(capacity),
+            base_timestamp(base_timestamp),
+            timestamps(std::make_unique_for_overwrite<std::int32_t[]>(capacity)),
+            keys(std::make_unique_for_overwrite<std::uint16_t[]>(capacity)),
+            frames(std::make_unique_for_overwrite<std::uint32_t[]>(capacity)),
+            flags(std::make_unique_for_overwrite<std::uint8_t[]>(capacity))
+        {
+        }
+
+        std::size_t capacity;
+        std::uint64_t base_timestamp;
+        std::unique_ptr<std::int32_t[]> timestamps;
+        std::unique_ptr<std::uint16_t[]> keys;
+        std::unique_ptr<std::uint32_t[]> frames;
+        std::unique_ptr<std::uint8_t[]> flags;
+        // Allocated by the writer before the first input that needs them is
+        // published, and never changed after
+        std::unique_ptr<std::uint64_t[]> wide_timestamps;
+        std::unique_ptr<std::uint64_t[]> device_timestamps;
+        std::unique_ptr<std::uint64_t[]> receive_timestamps;
+        std::unique_ptr<Motion[]> motion;
+        std::atomic<Chunk*> next = nullptr;
+    };
+
+public:
+    using value_type = Input;
+    using size_type = std::size_t;
+
+    // The columns of one chunk, as far as it was published
+    class column_view
+    {
+    public:
+        std::size_t size() const
+        {
+            return m_size;
+        }
+        // Offsets from base_timestamp(), except for inputs flagged wide_timestamp
+        std::uint64_t base_timestamp() const
+        {
+            return m_chunk->base_timestamp;
+        }
+        std::span<const std::int32_t> timestamp_offsets() const
+        {
+            return std::span(m_chunk->timestamps.get(), m_size);
+        }
+        // The keycode in the low 15 bits, pressed in the top one
+        std::span<const std::uint16_t> keys() const
+        {
+            return std::span(m_chunk->keys.get(), m_size);
+        }
+        std::span<const std::uint32_t> frames() const
+        {
+            return std::span(m_chunk->frames.get(), m_size);
+        }
+        std::span<const std::uint8_t> flags() const
+        {
+            return std::span(m_chunk->flags.get(), m_size);
+        }
+
+        std::uint64_t timestamp(std::size_t index) const
+        {
+            if (m_chunk->flags[index] & wide_timestamp)
+                return m_chunk->wide_timestamps[index];
+            return m_chunk->base_timestamp + m_chunk->timestamps[index];
+        }
+        Keycode code(std::size_t index) const
+        {
+            return static_cast<Keycode>(m_chunk->keys[index] & ~pressed_bit);
+        }
+        bool pressed(std::size_t index) const
+        {
+            return m_chunk->keys[index] & pressed_bit;
+        }
+        std::uint32_t frame(std::size_t index) const
+        {
+            return m_chunk->frames[index];
+        }
+        InputKind kind(std::size_t index) const
+        {
+            return m_chunk->flags[index] & motion ? InputKind::MOTION : InputKind::KEY;
+        }
+        std::optional<std::uint64_t> device_timestamp(std::size_t index) const
+        {
+            if (!(m_chunk->flags[index] & has_device_timestamp))
+                return std::nullopt;
+            return m_chunk->device_timestamps[index];
+        }
+        std::optional<std::uint64_t> receive_timestamp(std::size_t index) const
+        {
+            if (!(m_chunk->flags[index] & has_receive_timestamp))
+                return std::nullopt;
+            return m_chunk->receive_timestamps[index];
+        }
+        // Motion inputs only
+        std::int32_t dx(std::size_t index) const
+        {
+            return m_chunk->motion[index].dx;
+        }
+        std::int32_t dy(std::size_t index) const
+        {
+            return m_chunk->motion[index].dy;
+        }
+        std::uint32_t reports(std::size_t index) const
+        {
+            return m_chunk->motion[index].reports;
+        }
+        Input operator[](std::size_t index) const
+        {
+            return _decode(*m_chunk, index);
+        }
+
+    private:
+        friend class InputStore;
+        column_view(const Chunk* chunk, std::size_t size): m_chunk(chunk), m_size(size) {}
+
+        const Chunk* m_chunk;
+        std::size_t m_size;
+    };
+
+    // Walks the inputs published when it was created, until refresh() is
+    // called on it. Inputs are decoded on the fly, so they come by value.
+    class const_iterator
+    {
+    public:
+        using iterator_concept = std::forward_iterator_tag;
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Input;
+        using difference_type = std::ptrdiff_t;
+        using reference = Input;
+
+        struct pointer
+        {
+            Input input;
+            const Input* operator->() const
+            {
+                return &input;
+            }
+        };
+
+        const_iterator() = default;
+
+        reference operator*() const
+        {
+            return _decode(*m_chunk, m_offset);
+        }
+        pointer operator->() const
+        {
+            return { **this };
+        }
+        const_iterator& operator++()
+        {
+            ++m_index;
+            if (++m_offset == m_chunk->capacity)
+            {
+                // the next chunk may not exist yet, refresh() moves on to it
+                if (m_index < m_size)
+                {
+                    m_chunk = m_chunk->next.load(std::memory_order_relaxed);
+                    m_offset = 0;
+                }
+                else
+                {
+                    m_behind = true;
+                }
+            }
+            return *this;
+        }
+        const_iterator operator++(int)
+        {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+        bool operator==(const const_iterator& other) const
+        {
+            if (_at_end() || other._at_end())
+                return _at_end() == other._at_end();
+            return m_index == other.m_index;
+        }
+
+    private:
+        friend class InputStore;
+        const_iterator(const Chunk* chunk, std::size_t size): m_chunk(chunk), m_size(size) {}
+        bool _at_end() const
+        {
+            return m_index >= m_size;
+        }
+
+        const Chunk* m_chunk = nullptr;
+        std::size_t m_index = 0;
+        // Within m_chunk
+        std::size_t m_offset = 0;
+        std::size_t m_size = 0;
+        bool m_behind = false;
+    };
+
+    InputStore() = default;
+    ~InputStore()
+    {
+        clear();
+    }
+    InputStore(const InputStore&) = delete;
+    InputStore& operator=(const InputStore&) = delete;
+
+    // Writer only
+    void push_back(const Input& input)
+    {
+        _store(input);
+        // publishes the input, and the chunk and columns it went into
+        m_size.store(m_size.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    // Writer only, the inputs are published together
+    void append(std::span<const Input> inputs)
+    {
+        for (auto& input: inputs)
+            _store(input);
+        m_size.store(m_size.load(std::memory_order_relaxed) + inputs.size(), std::memory_order_release);
+    }
+
+    // Neither the writer nor any reader may be active
+    void clear()
+    {
+        auto chunk = m_head.load(std::memory_order_relaxed);
+        while (chunk)
+        {
+            auto next = chunk->next.load(std::memory_order_relaxed);
+            delete chunk;
+            chunk = next;
+        }
+        m_head.store(nullptr, std::memory_order_relaxed);
+        m_tail = nullptr;
+        m_tail_size = 0;
+        m_size.store(0, std::memory_order_relaxed);
+    }
+
+    std::size_t size() const
+    {
+        return m_size.load(std::memory_order_acquire);
+    }
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    const_iterator begin() const
+    {
+        // the size is read first, its acquire makes the chunks it covers visible
+        auto size = m_size.load(std::memory_order_acquire);
+        return const_iterator(m_head.load(std::memory_order_relaxed), size);
+    }
+    const_iterator end() const
+    {
+        return {};
+    }
+    // Lets an iterator walk on into what has been appended since it was created
+    void refresh(const_iterator& it) const
+    {
+        it.m_size = m_size.load(std::memory_order_acquire);
+        if (it.m_index >= it.m_size)
+            return;
+        if (!it.m_chunk)
+        {
+            it.m_chunk = m_head.load(std::memory_order_relaxed);
+        }
+        else if (it.m_behind)
+        {
+            it.m_chunk = it.m_chunk->next.load(std::memory_order_relaxed);
+            it.m_offset = 0;
+        }
+        it.m_behind = false;
+    }
+
+    // Walks the chunks, index must be below a size() read before
+    Input operator[](std::size_t index) const
+    {
+        auto chunk = m_head.load(std::memory_order_relaxed);
+        while (index >= chunk->capacity)
+        {
+            index -= chunk->capacity;
+            chunk = chunk->next.load(std::memory_order_relaxed);
+        }
+        return _decode(*chunk, index);
+    }
+
+    // Calls fn(const column_view&) for each chunk, in order
+    template <typename F>
+    void visit_columns(F&& fn) const
+    {
+        auto size = m_size.load(std::memory_order_acquire);
+        auto chunk = m_head.load(std::memory_order_relaxed);
+        while (size > 0)
+        {
+            auto count = std::min(size, chunk->capacity);
+            fn(column_view(chunk, count));
+            size -= count;
+            chunk = chunk->next.load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+    void _store(const Input& input)
+    {
+        if (!m_tail || m_tail_size == m_tail->capacity)
+            _grow(input.Timestamp);
+        auto& chunk = *m_tail;
+        auto offset = m_tail_size++;
+
+        std::uint8_t flags = 0;
+        auto relative = static_cast<std::int64_t>(input.Timestamp - chunk.base_timestamp);
+        if (
+            relative >= std::numeric_limits<std::int32_t>::min() &&
+            relative <= std::numeric_limits<std::int32_t>::max()
+        )
+        {
+            chunk.timestamps[offset] = static_cast<std::int32_t>(relative);
+        }
+        else
+        {
+            // a device that was idle for over half an hour
+            flags |= wide_timestamp;
+            chunk.timestamps[offset] = 0;
+            _column(chunk, chunk.wide_timestamps)[offset] = input.Timestamp;
+        }
+        chunk.keys[offset] = static_cast<std::uint16_t>(input.Code) | (input.Pressed ? pressed_bit : 0);
+        chunk.frames[offset] = input.Frame;
+        if (input.DeviceTimestamp)
+        {
+            flags |= has_device_timestamp;
+            _column(chunk, chunk.device_timestamps)[offset] = *input.DeviceTimestamp;
+        }
+        if (input.ReceiveTimestamp)
+        {
+            flags |= has_receive_timestamp;
+            _column(chunk, chunk.receive_timestamps)[offset] = *input.ReceiveTimestamp;
+        }
+        if (input.Kind == InputKind::MOTION)
+        {
+            flags |= motion;
+            _column(chunk, chunk.motion)[offset] = Motion{ input.DX, input.DY, input.Reports };
+        }
+        chunk.flags[offset] = flags;
+    }
+
+    template <typename U>
+    static U* _column(const Chunk& chunk, std::unique_ptr<U[]>& column)
+    {
+        if (!column)
+            column = std::make_unique_for_overwrite<U[]>(chunk.capacity);
+        return column.get();
+    }
+
+    static Input _decode(const Chunk& chunk, std::size_t offset)
+    {
+        auto flags = chunk.flags[offset];
+        auto key = chunk.keys[offset];
+        Input input{
+            .Timestamp = flags & wide_timestamp ?
+                chunk.wide_timestamps[offset] :
+                chunk.base_timestamp + chunk.timestamps[offset],
+            .Pressed = (key & pressed_bit) != 0,
+            .Code = static_cast<Keycode>(key & ~pressed_bit),
+            .Frame = chunk.frames[offset]
+        };
+        if (flags & has_device_timestamp)
+            input.DeviceTimestamp = chunk.device_timestamps[offset];
+        if (flags & has_receive_timestamp)
+            input.ReceiveTimestamp = chunk.receive_timestamps[offset];
+        if (flags & motion)
+        {
+            auto& [dx, dy, reports] = chunk.motion[offset];
+            input.Kind = InputKind::MOTION;
+            input.DX = dx;
+            input.DY = dy;
+            input.Reports = reports;
+        }
+        return input;
+    }
+
+    void _grow(std::uint64_t base_timestamp)
+    {
+        auto capacity = m_tail ? std::min(m_tail->capacity * 2, max_chunk_size) : first_chunk_size;
+        auto chunk = new Chunk(capacity, base_timestamp);
+        if (m_tail)
+            m_tail->next.store(chunk, std::memory_order_relaxed);
+        else
+            m_head.store(chunk, std::memory_order_relaxed);
+        m_tail = chunk;
+        m_tail_size = 0;
+    }
+
+    std::atomic<Chunk*> m_head = nullptr;
+    // Only touched by the writer
+    Chunk* m_tail = nullptr;
+    std::size_t m_tail_size = 0;
+    std::atomic<std::size_t> m_size = 0;
+};
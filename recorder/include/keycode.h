@@ -1,8 +1,10 @@
 #pragma once
+#include <cstdint>
 #include <string>
 
-// Based on HID 1.0 specification, with extra values for mouse and gamepad buttons
-enum class Keycode {
+// Based on HID 1.0 specification, with extra values for mouse and gamepad buttons.
+// 16 bits wide, so it packs next to Input::Pressed.
+enum class Keycode : std::uint16_t {
     None = 0x00,
     ErrorRollOver = 0x01,
     POSTFail = 0x02,
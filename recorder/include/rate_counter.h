@@ -0,0 +1,67 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Counts events in fixed time slices, so the rate over a recent window can be
+// read from any thread while a single thread adds to it. Neither side takes a
+// lock. A slice that is being reused while it's read may be missed, the rate
+// is for showing, not for measuring.
+class RateCounter
+{
+public:
+    using clock = std::chrono::steady_clock;
+    static constexpr std::chrono::milliseconds resolution{100};
+    static constexpr std::size_t slice_count = 128;
+    // The longest window a rate can be asked for
+    static constexpr std::chrono::milliseconds max_window = resolution * (slice_count - 1);
+
+    // Writer only
+    void add(clock::time_point now, std::uint64_t count)
+    {
+        auto index = _index(now);
+        auto& slice = m_slices[index % slice_count];
+        if (slice.index.load(std::memory_order_relaxed) != index)
+        {
+            // cleared before it's claimed, readers that see the new index see
+            // the cleared count or a later one
+            slice.count.store(0, std::memory_order_relaxed);
+            slice.index.store(index, std::memory_order_release);
+        }
+        slice.count.store(slice.count.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    // Events per second over the window before now
+    double rate(clock::time_point now, std::chrono::milliseconds window) const
+    {
+        window = std::clamp(window, resolution, max_window);
+        auto index = _index(now);
+        std::uint64_t slices = window / resolution;
+        std::uint64_t count = 0;
+        for (auto& slice: m_slices)
+        {
+            auto slice_index = slice.index.load(std::memory_order_acquire);
+            if (slice_index <= index && slice_index + slices >= index)
+                count += slice.count.load(std::memory_order_acquire);
+        }
+        // the current slice is only partly over
+        auto elapsed = std::chrono::duration<double>(resolution * slices + (now.time_since_epoch() % resolution));
+        return count / elapsed.count();
+    }
+
+private:
+    static std::uint64_t _index(clock::time_point now)
+    {
+        return now.time_since_epoch() / resolution;
+    }
+
+    struct Slice
+    {
+        std::atomic<std::uint64_t> index = ~0ULL;
+        std::atomic<std::uint64_t> count = 0;
+    };
+    std::array<Slice, slice_count> m_slices;
+};
@@ -1,45 +1,217 @@
 #pragma once
 
+#include <append_buffer.h>
 #include <device.h>
+#include <input.h>
+#include <input_store.h>
 #include <keycode.h>
+#include <rate_counter.h>
 #include <memory>
 #include <atomic>
 #include <cstdint>
 #include <chrono>
+#include <condition_variable>
+#include <map>
+#include <stop_token>
 #include <string>
 #include <string_view>
 #include <deque>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 #include <boost/unordered/concurrent_flat_map.hpp>
 #include <boost/signals2.hpp>
 #include <spdlog/fwd.h>
 
-struct Input {
+// A raw report as it came from the device. Recorded by backends that see every
+// report the device sends, not just the ones that change its state.
+struct Report {
     std::uint64_t Timestamp;
-    bool Pressed;
-    Keycode Code;
+    // Matches Input::Frame of the inputs decoded from this report
+    std::uint32_t Frame;
+    // Only kept if RecorderOptions::KeepReportData is set
+    std::vector<unsigned char> Data;
+};
+
+enum class GamepadAxis : std::uint8_t {
+    LeftX,
+    LeftY,
+    RightX,
+    RightY,
+    LeftTrigger,
+    RightTrigger
+};
+
+// One axis of one gamepad report, there is a sample for every axis that
+// changed in the report. Values are scaled from the range the device reports
+// to the full int16 range, so every controller looks the same and a sample
+// stays at 16 bytes.
+struct AxisSample {
+    std::uint64_t Timestamp;
+    // Matches Input::Frame of the buttons that changed in the same report
+    std::uint32_t Frame;
+    GamepadAxis Axis;
+    std::int16_t Value;
+};
+
+// A stretch in which a device's kernel buffer overflowed and its inputs were
+// lost. Transitions missed in between are synthesized at End, from the key
+// state read back from the device.
+struct InputGap {
+    std::uint64_t Start;
+    std::uint64_t End;
+    std::uint32_t Synthesized;
+    // False if reading back the key state failed, nothing was synthesized
+    bool Resynced;
+};
+
+struct OverflowStats {
+    std::uint64_t Drops = 0;
+    std::uint64_t Resyncs = 0;
+    std::uint64_t Synthesized = 0;
+    std::vector<InputGap> Gaps;
+};
+
+// The host clock timestamps are taken on
+enum class CaptureClock {
+    MONOTONIC,
+    // Like MONOTONIC, but keeps counting while the system is suspended
+    BOOTTIME,
+    // Wall-clock time, jumps when the clock is set
+    REALTIME
+};
+
+// Readings of the host clocks taken together. They map session timestamps to
+// wall-clock time, which makes recordings comparable across machines with
+// synchronized clocks. The other clocks are read in between two readings of
+// the capture clock, Timestamp is their midpoint.
+struct ClockSample {
+    // On the capture clock, like Input::Timestamp
+    std::uint64_t Timestamp;
+    // Nanoseconds between the two readings of the capture clock
+    std::uint32_t Uncertainty;
+    // Nanoseconds since each clock's epoch
+    std::int64_t Monotonic;
+    std::int64_t Boottime;
+    std::int64_t Realtime;
 };
 
 enum class RecorderBackend {
     AUTO,
     WINDOWS_GAMEINPUT,
     WINDOWS_RAWINPUT,
-    LINUX_EVDEV
+    LINUX_EVDEV,
+    LINUX_IO_URING,
+    LINUX_HIDRAW,
+    LINUX_USBMON
+};
+
+enum class MouseMotion {
+    OFF,
+    // One input per report
+    RAW,
+    // Reports are summed up over RecorderOptions::MotionInterval
+    COALESCED
 };
 
+struct RecorderOptions {
+    // Number of threads reading devices. Only used by the Linux backends.
+    unsigned ReaderThreads = 1;
+    // Reader thread index for specific device IDs, other devices are spread
+    // across the reader threads by hashing their ID
+    std::unordered_map<std::string, unsigned> ReaderThreadMap;
+    // CPU to pin each reader thread to, by thread index. Threads without an
+    // entry, or with a negative one, are left unpinned.
+    std::vector<int> ReaderCpus;
+    // Run the capture threads with SCHED_FIFO at RealTimePriority, lock the
+    // process memory and minimize their timer slack. Only used by the Linux backends.
+    bool RealTime = false;
+    int RealTimePriority = 50;
+    // Keep the payload of every raw report, for backends that record them
+    bool KeepReportData = false;
+    // Record mouse motion along with the buttons. Only used by the evdev backends.
+    MouseMotion Motion = MouseMotion::OFF;
+    // Microseconds covered by one coalesced motion input
+    std::uint32_t MotionInterval = 1000;
+    // Readers spin on non-blocking reads of their devices instead of sleeping
+    // until one has inputs, trading a CPU per reader for wakeup latency. Only
+    // used by the evdev backend.
+    bool BusyPoll = false;
+    // Longest sleep in microseconds once the devices went quiet, sleeps double
+    // from 1us up to it. 0 keeps spinning without ever sleeping.
+    std::uint32_t BusyPollBackoff = 0;
+    // Percentage of a CPU each busy polling reader may use, it sleeps out the
+    // rest of every 10ms once it has used its share
+    unsigned BusyPollCpuShare = 100;
+    // Clock of the timestamps. Only used by the Linux backends, usbmon always
+    // uses REALTIME.
+    CaptureClock Clock = CaptureClock::MONOTONIC;
+    // Milliseconds between clock samples taken during a recording, on top of
+    // the ones at Start and Stop. 0 only takes those.
+    std::uint32_t ClockSampleInterval = 1000;
+    // Keep the devices open and the readers running after Stop, so the next
+    // Start only has to open the capture gate. Starting with a different set
+    // of device types still reopens them. Only used by the evdev backends.
+    bool WarmStandby = false;
+};
+
+// Which of the real-time settings actually took effect, they need privileges
+struct RealTimeStatus {
+    bool Requested = false;
+    bool MemoryLocked = false;
+    // Set only if every capture thread got it
+    bool Scheduler = false;
+    bool TimerSlack = false;
+};
+
+class InputCursor;
+
 class Recorder {
 public:
     class Impl;
     using UsbDeviceMap = boost::unordered::concurrent_flat_map<std::string, std::optional<UsbDeviceInfo>>;
     using DeviceMap = boost::unordered::concurrent_flat_map<std::string, Device>;
-    using InputMap = boost::unordered::concurrent_flat_map<std::string, std::deque<Input>>;
+    // Appended to by the backend thread of its device only
+    using InputBuffer = InputStore;
+    // Buffers are created when a device sends its first input, the map isn't
+    // touched for the ones after
+    using InputMap = boost::unordered::concurrent_flat_map<std::string, std::unique_ptr<InputBuffer>>;
+    using OverflowMap = boost::unordered::concurrent_flat_map<std::string, OverflowStats>;
+    // Like InputBuffer, appended to by the backend thread of the device only
+    using ReportBuffer = AppendBuffer<Report>;
+    using AxisBuffer = AppendBuffer<AxisSample>;
+    // By device handle. Every device gets its buffers when it's added, they
+    // stay empty unless the backend records reports or the device has axes.
+    using ReportMap = boost::unordered::concurrent_flat_map<DeviceHandle, std::unique_ptr<ReportBuffer>>;
+    using AxisMap = boost::unordered::concurrent_flat_map<DeviceHandle, std::unique_ptr<AxisBuffer>>;
+    // A device by handle, the entries never change once they're added
+    struct DeviceEntry {
+        std::string Id;
+        InputBuffer* Inputs;
+        ReportBuffer* Reports;
+        AxisBuffer* Axes;
+        RateCounter* Rate;
+    };
+    using DeviceRegistry = AppendBuffer<DeviceEntry, 64>;
+    // Fired from the resolver thread once the USB device has been looked up
     using UsbDeviceSignal = boost::signals2::signal<void(const std::string&, const UsbDeviceInfo&)>;
-    using DeviceSignal = boost::signals2::signal<void(const std::string&, const Device&)>;
-    using InputSignal = boost::signals2::signal<void(const std::string&, const Input&)>;
+    // Announces the handle of a device, inputs only carry that. Fired from the
+    // resolver thread once the name is known, its inputs may come first.
+    using DeviceSignal = boost::signals2::signal<void(DeviceHandle, const std::string&, const Device&)>;
+    using InputSignal = boost::signals2::signal<void(DeviceHandle, const Input&)>;
     using StartSignal = boost::signals2::signal<void()>;
     using StopSignal = boost::signals2::signal<void()>;
 
-    Recorder(RecorderBackend backend = RecorderBackend::AUTO, std::shared_ptr<spdlog::logger> logger = nullptr);
+    Recorder(
+        RecorderBackend backend = RecorderBackend::AUTO,
+        std::shared_ptr<spdlog::logger> logger = nullptr,
+        const RecorderOptions& options = {}
+    );
     ~Recorder();
 
     UsbDeviceSignal& OnUsbDevice()
@@ -71,13 +243,41 @@ public:
     std::chrono::steady_clock::duration Elapsed() const;
 
     RecorderBackend Backend() const;
+    RealTimeStatus RealTime() const;
+    // Empty if the backend doesn't know which clock it uses
+    std::optional<CaptureClock> Clock() const;
+    std::vector<ClockSample> ClockSamples() const;
     const UsbDeviceMap& UsbDevices() const;
     const DeviceMap& Devices() const;
     const InputMap& Inputs() const;
+    // By the handle of a device announced through OnDevice
+    const std::string& DeviceId(DeviceHandle handle) const;
+    const InputBuffer& Inputs(DeviceHandle handle) const;
+    // Only devices that overflowed at least once are present
+    const OverflowMap& Overflows() const;
+    // Only filled by backends that see every report, like hidraw
+    const ReportMap& Reports() const;
+    const ReportBuffer& Reports(DeviceHandle handle) const;
+    // Only filled for gamepads
+    const AxisMap& Axes() const;
+    const AxisBuffer& Axes(DeviceHandle handle) const;
+    // The counts and rates are kept up on ingest, so they are cheap enough to
+    // poll as often as a dashboard likes. Not while Start resets them.
     size_t DeviceCount() const;
     size_t InputCount() const;
+    size_t InputCount(DeviceHandle handle) const;
+    // Inputs per second over the window before now, up to RateCounter::max_window
+    double InputRate(std::chrono::milliseconds window = std::chrono::seconds(1)) const;
+    double InputRate(DeviceHandle handle, std::chrono::milliseconds window = std::chrono::seconds(1)) const;
 
 private:
+    friend class InputCursor;
+
+    DeviceHandle _add_device(const std::string& id, std::uint16_t vid, std::uint16_t pid);
+    void _resolve_devices(const std::stop_token& stop);
+    void _resolve_device(const std::string& id, std::uint16_t vid, std::uint16_t pid);
+    void _wait_resolved();
+
     bool m_running = false;
 
     std::unique_ptr<Impl> p_impl;
@@ -86,6 +286,19 @@ private:
     UsbDeviceMap m_usb_devices;
     DeviceMap m_devices;
     InputMap m_inputs;
+    // Written under m_registry_mutex, read without it
+    DeviceRegistry m_registry;
+    std::mutex m_registry_mutex;
+    // Owns the rate counters of the registry, same lock
+    std::deque<RateCounter> m_rates;
+    std::atomic<std::size_t> m_input_count = 0;
+    // Bumped by every Start, tells cursors that the storage they followed is gone
+    std::atomic<unsigned> m_session = 0;
+    OverflowMap m_overflows;
+    ReportMap m_reports;
+    AxisMap m_axes;
+    mutable std::mutex m_clock_mutex;
+    std::vector<ClockSample> m_clock_samples;
     UsbDeviceSignal m_sig_usb_device;
     DeviceSignal m_sig_device;
     InputSignal m_sig_input;
@@ -94,4 +307,64 @@ private:
 
     std::chrono::system_clock::time_point m_start_wallclock;
     std::chrono::steady_clock::time_point m_start_time, m_end_time;
+
+    // Names and USB descriptors take sysfs walks, so new devices are queued
+    // for m_resolver_thread instead of being looked up on the capture thread
+    using DeviceKey = std::tuple<std::string, std::uint16_t, std::uint16_t>;
+    struct DeviceMetadata {
+        std::string Name;
+        std::optional<std::string> UsbDeviceId;
+        std::optional<UsbDeviceInfo> UsbDevice;
+    };
+    std::mutex m_resolver_mutex;
+    std::condition_variable_any m_resolver_cv;
+    std::deque<DeviceKey> m_resolve_queue;
+    bool m_resolving = false;
+    // Only touched by the resolver thread. The VID and PID are part of the key,
+    // a node that is reused by another device doesn't get the old name.
+    std::map<DeviceKey, DeviceMetadata> m_metadata_cache;
+    // Last, so it's gone before anything it uses
+    std::jthread m_resolver_thread;
+};
+
+// Pulls the inputs recorded since it was last polled. Unlike OnInput, it never
+// runs consumer code on the capture threads, so a slow consumer only falls
+// behind instead of delaying capture. A cursor belongs to one consumer thread
+// and must not be polled while Start resets the storage, it starts over with
+// the new recording on the poll after.
+class InputCursor {
+public:
+    explicit InputCursor(const Recorder& recorder): m_recorder(recorder) {}
+
+    // Calls fn(handle, input) for the new inputs, device by device, and returns
+    // how many there were. Whatever is over max_inputs is left for the next poll.
+    template <typename F>
+    std::size_t Poll(F&& fn, std::size_t max_inputs = std::numeric_limits<std::size_t>::max())
+    {
+        auto session = m_recorder.m_session.load(std::memory_order_acquire);
+        if (session != m_session)
+        {
+            m_positions.clear();
+            m_session = session;
+        }
+        std::size_t count = 0;
+        DeviceHandle handle = 0;
+        for (auto& device: m_recorder.m_registry)
+        {
+            auto& inputs = *device.Inputs;
+            if (handle == m_positions.size())
+                m_positions.push_back(inputs.begin());
+            auto& position = m_positions[handle];
+            inputs.refresh(position);
+            for (; position != inputs.end() && count < max_inputs; ++position, ++count)
+                fn(handle, *position);
+            ++handle;
+        }
+        return count;
+    }
+
+private:
+    const Recorder& m_recorder;
+    unsigned m_session = 0;
+    std::vector<Recorder::InputBuffer::const_iterator> m_positions;
 };
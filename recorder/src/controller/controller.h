@@ -5,7 +5,10 @@
 #include <ixwebsocket/IXWebSocket.h>
 #include <uwebsockets/App.h>
 #include <atomic>
+#include <chrono>
+#include <functional>
 #include <string_view>
+#include <thread>
 
 class Controller
 {
@@ -19,6 +22,30 @@ protected:
     std::shared_ptr<spdlog::logger> m_logger;
 };
 
+// Polls an InputCursor on its own thread while the recorder is recording, and
+// once more after it stopped so the last inputs aren't left behind
+class InputPoller
+{
+public:
+    using PollFunction = std::function<void(InputCursor&)>;
+
+    InputPoller(Recorder& recorder, std::chrono::milliseconds interval, PollFunction poll);
+    ~InputPoller();
+    InputPoller(const InputPoller&) = delete;
+    InputPoller& operator=(const InputPoller&) = delete;
+
+private:
+    void _stop();
+
+    Recorder& m_recorder;
+    std::chrono::milliseconds m_interval;
+    PollFunction m_poll;
+    InputCursor m_cursor;
+    std::jthread m_thread;
+    boost::signals2::scoped_connection m_start_connection;
+    boost::signals2::scoped_connection m_stop_connection;
+};
+
 class ConsoleController: public Controller
 {
 public:
@@ -3,6 +3,8 @@
 #include "../serializer/serializer.h"
 #include <recorder.h>
 #include <chrono>
+#include <iterator>
+#include <optional>
 #include <print>
 #include <fstream>
 #include <thread>
@@ -69,7 +71,10 @@ void ConsoleController::Run()
     {
         while (rec.Recording())
         {
-            std::print("\rDevices: {}, Inputs: {}", rec.DeviceCount(), rec.InputCount());
+            std::print(
+                "\rDevices: {}, Inputs: {} ({:.0f}/s)  ",
+                rec.DeviceCount(), rec.InputCount(), rec.InputRate()
+            );
             std::fflush(stdout);
             std::this_thread::sleep_for(100ms);
         }
@@ -83,18 +88,32 @@ void ConsoleController::Run()
     auto& inputs = rec.Inputs();
     std::println("Recorded {} devices", inputs.size());
     inputs.cvisit_all([&](const Recorder::InputMap::value_type& input_pair) {
-        auto& [device_id, events] = input_pair;
-        if (events.size() == 0)
+        auto& device_id = input_pair.first;
+        auto& events = *input_pair.second;
+        if (events.empty())
             return;
         std::println("- Device {}", device_id);
         auto& device_map = rec.Devices();
+        std::optional<DeviceHandle> handle;
         device_map.cvisit(device_id, [&](const Recorder::DeviceMap::value_type& device_pair) {
             std::println("  - Name: {}", device_pair.second.Name);
+            handle = device_pair.second.Handle;
         });
         std::println("  - Recorded {} events", events.size());
+        if (handle && !rec.Axes(*handle).empty())
+            std::println("  - Recorded {} axis samples", rec.Axes(*handle).size());
+        rec.Overflows().cvisit(device_id, [&](const Recorder::OverflowMap::value_type& overflow_pair) {
+            auto& stats = overflow_pair.second;
+            std::println(
+                "  - Dropped inputs {} times, {} inputs synthesized. Diffs around the gaps aren't reliable!",
+                stats.Drops, stats.Synthesized
+            );
+        });
         std::println("  - First 100 diffs:");
-        for (std::size_t i = 1; i < std::min((std::size_t)101, events.size()); i++)
-            std::println("    - Diff {}: {}us", i, events[i].Timestamp - events[i - 1].Timestamp);
+        auto prev = events.begin();
+        std::size_t i = 1;
+        for (auto it = std::next(prev); it != events.end() && i <= 100; prev = it++, i++)
+            std::println("    - Diff {}: {}us", i, it->Timestamp - prev->Timestamp);
     });
 
 #ifdef __linux__
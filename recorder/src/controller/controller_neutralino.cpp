@@ -54,7 +54,7 @@ void NeutralinoController::Run()
         }
     );
     auto conn2 = m_recorder.OnDevice().connect(
-        [&](const std::string& id, const Device& device) {
+        [&](DeviceHandle handle, const std::string& id, const Device& device) {
             try {
                 auto json = serializer.GetJson(device);
                 this->_sendNeutralinoEvent("device", json::object{{id, json}});
@@ -65,18 +65,22 @@ void NeutralinoController::Run()
             }
         }
     );
-    auto conn3 = m_recorder.OnInput().connect(
-        [&](const std::string& id, const Input& input) {
+    InputPoller poller(m_recorder, 10ms, [&](InputCursor& cursor) {
+        cursor.Poll([&](DeviceHandle handle, const Input& input) {
             try {
                 auto json = serializer.GetJson(input);
-                this->_sendNeutralinoEvent("input", json::object{{id, json}});
+                // the analyzer keys inputs by device ID, and only knows about keys
+                this->_sendNeutralinoEvent(
+                    input.Kind == InputKind::MOTION ? "motion" : "input",
+                    json::object{{m_recorder.DeviceId(handle), json}}
+                );
             }
             catch (const std::exception& e) {
                 m_logger->error("dead: {}", e.what());
                 return;
             }
-        }
-    );
+        });
+    });
 
     m_logger->info("Waiting for Neutralino connection info");
     std::error_code ec;
@@ -2,8 +2,11 @@
 #include <charconv>
 #include <format>
 #include <string>
+#include <vector>
 #include <spdlog/spdlog.h>
 
+using namespace std::literals;
+
 WebSocketController::WebSocketController(Recorder& recorder, std::shared_ptr<spdlog::logger> logger):
     Controller(recorder, logger)
 {
@@ -70,29 +73,37 @@ void WebSocketController::Run()
         }
     );
     auto conn2 = m_recorder.OnDevice().connect(
-        [this, loop](const std::string& id, const Device& device) {
+        [this, loop](DeviceHandle handle, const std::string& id, const Device& device) {
             auto json = m_serializer.Serialize(device);
-            loop->defer([this, id, json = std::move(json)]() {
-                m_app.publish(
-                    "data", std::format(R"({{"type":"device","id":"{}","data":{}}})", id, json),
-                    uWS::OpCode::TEXT, true
-                );
-            });
-        }
-    );
-    auto conn3 = m_recorder.OnInput().connect(
-        [this, loop](const std::string& id, const Input& input) {
-            auto json = m_serializer.Serialize(input);
-            loop->defer([this, id, json = std::move(json)]() {
+            loop->defer([this, handle, id, json = std::move(json)]() {
                 m_app.publish(
-                    "data", std::format(R"({{"type":"input","id":"{}","data":{}}})", id, json),
+                    "data", std::format(R"({{"type":"device","id":"{}","handle":{},"data":{}}})", id, handle, json),
                     uWS::OpCode::TEXT, true
                 );
             });
         }
     );
+    // inputs are pulled off the recording, so a busy loop never holds up capture
+    InputPoller poller(m_recorder, 10ms, [this, loop](InputCursor& cursor) {
+        std::vector<std::string> messages;
+        cursor.Poll([&](DeviceHandle handle, const Input& input) {
+            // The device message with the handle is only sent once the device
+            // has been looked up, which can be after its first inputs. The ID
+            // is kept, as it was before handles, so inputs can always be matched.
+            messages.push_back(std::format(
+                R"({{"type":"{}","id":"{}","handle":{},"data":{}}})",
+                input.Kind == InputKind::MOTION ? "motion" : "input",
+                m_recorder.DeviceId(handle), handle, m_serializer.Serialize(input)
+            ));
+        });
+        if (messages.empty())
+            return;
+        loop->defer([this, messages = std::move(messages)]() {
+            for (auto& message: messages)
+                m_app.publish("data", message, uWS::OpCode::TEXT, true);
+        });
+    });
     m_app.run();
     conn1.disconnect();
     conn2.disconnect();
-    conn3.disconnect();
 }
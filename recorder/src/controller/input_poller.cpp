@@ -0,0 +1,36 @@
+#include "controller.h"
+#include <stop_token>
+
+InputPoller::InputPoller(Recorder& recorder, std::chrono::milliseconds interval, PollFunction poll):
+    m_recorder(recorder), m_interval(interval), m_poll(std::move(poll)), m_cursor(recorder)
+{
+    m_start_connection = m_recorder.OnStart().connect([this]() {
+        m_thread = std::jthread([this](const std::stop_token& stop) {
+            while (!stop.stop_requested())
+            {
+                m_poll(m_cursor);
+                std::this_thread::sleep_for(m_interval);
+            }
+        });
+    });
+    // the backend has been stopped when this fires, nothing is appended anymore
+    m_stop_connection = m_recorder.OnStop().connect([this]() {
+        _stop();
+        m_poll(m_cursor);
+    });
+}
+
+InputPoller::~InputPoller()
+{
+    m_start_connection.disconnect();
+    m_stop_connection.disconnect();
+    _stop();
+}
+
+void InputPoller::_stop()
+{
+    if (!m_thread.joinable())
+        return;
+    m_thread.request_stop();
+    m_thread.join();
+}
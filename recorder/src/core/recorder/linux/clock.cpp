@@ -0,0 +1,74 @@
+#include "clock.h"
+#include <algorithm>
+
+clockid_t to_clockid(CaptureClock clock)
+{
+    switch (clock)
+    {
+    case CaptureClock::BOOTTIME:
+        return CLOCK_BOOTTIME;
+    case CaptureClock::REALTIME:
+        return CLOCK_REALTIME;
+    default:
+        return CLOCK_MONOTONIC;
+    }
+}
+
+static std::int64_t clock_nsec(clockid_t clock)
+{
+    timespec now;
+    clock_gettime(clock, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+std::uint64_t clock_usec(clockid_t clock)
+{
+    return clock_nsec(clock) / 1000;
+}
+
+ClockSample sample_clocks(clockid_t clock, std::uint64_t ref_usec)
+{
+    // all of these go through the vDSO, so the bracket is well below a microsecond
+    // unless we get preempted, which Uncertainty then shows
+    auto before = clock_nsec(clock);
+    auto monotonic = clock_nsec(CLOCK_MONOTONIC);
+    auto boottime = clock_nsec(CLOCK_BOOTTIME);
+    auto realtime = clock_nsec(CLOCK_REALTIME);
+    auto after = clock_nsec(clock);
+    return ClockSample{
+        .Timestamp = static_cast<std::uint64_t>(before + (after - before) / 2) / 1000 - ref_usec,
+        .Uncertainty = static_cast<std::uint32_t>(after - before),
+        .Monotonic = monotonic,
+        .Boottime = boottime,
+        .Realtime = realtime
+    };
+}
+
+clock_sampler::clock_sampler(clockid_t clock, std::uint32_t interval_ms):
+    m_clock(clock), m_interval_usec(interval_ms * 1000ULL),
+    m_next_usec(clock_usec(CLOCK_MONOTONIC) + m_interval_usec)
+{
+}
+
+int clock_sampler::timeout() const
+{
+    if (!m_interval_usec)
+        return -1;
+    auto now = clock_usec(CLOCK_MONOTONIC);
+    if (now >= m_next_usec)
+        return 0;
+    // rounded up, so we don't wake up just before the sample is due
+    return static_cast<int>((m_next_usec - now + 999) / 1000);
+}
+
+std::optional<ClockSample> clock_sampler::poll(std::uint64_t ref_usec)
+{
+    if (!m_interval_usec)
+        return std::nullopt;
+    auto now = clock_usec(CLOCK_MONOTONIC);
+    if (now < m_next_usec)
+        return std::nullopt;
+    // skip the samples we missed instead of catching up on them
+    m_next_usec = std::max(m_next_usec + m_interval_usec, now + 1);
+    return sample_clocks(m_clock, ref_usec);
+}
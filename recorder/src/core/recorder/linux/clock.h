@@ -0,0 +1,28 @@
+#pragma once
+
+#include <recorder.h>
+#include <cstdint>
+#include <optional>
+#include <time.h>
+
+clockid_t to_clockid(CaptureClock clock);
+std::uint64_t clock_usec(clockid_t clock);
+// Reads every host clock between two readings of the capture clock. ref_usec
+// is the start of the session on the capture clock.
+ClockSample sample_clocks(clockid_t clock, std::uint64_t ref_usec);
+
+// Takes a clock sample every interval from a loop that waits with a timeout
+class clock_sampler
+{
+public:
+    clock_sampler(clockid_t clock, std::uint32_t interval_ms);
+    // Milliseconds until the next sample is due, -1 without periodic samples
+    int timeout() const;
+    // A sample if one is due, ref_usec is the start of the session on the capture clock
+    std::optional<ClockSample> poll(std::uint64_t ref_usec);
+
+private:
+    clockid_t m_clock;
+    std::uint64_t m_interval_usec;
+    std::uint64_t m_next_usec;
+};
@@ -2,20 +2,33 @@
 #include <systemd/sd-device.h>
 #include <cstdio>
 #include <cstring>
+#include <format>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <span>
 #include <vector>
 #include <tuple>
 #include <fcntl.h>
+#include <glob.h>
 #include <unistd.h>
 
-std::tuple<const char*, const char*> subsys_driver_chain[] = {
+using subsys_driver = std::tuple<const char*, const char*>;
+
+subsys_driver subsys_driver_chain[] = {
     { "input", "" },
     { "input", "" },
     { "hid", "hid-generic" },
     { "usb", "usbhid" },
 };
 
-std::optional<std::string> find_usb_device(std::string_view path)
+subsys_driver hidraw_subsys_driver_chain[] = {
+    { "hidraw", "" },
+    { "hid", "hid-generic" },
+    { "usb", "usbhid" },
+};
+
+static std::optional<std::string> find_usb_device(std::string_view path, std::span<const subsys_driver> chain)
 {
     sd_device *current = nullptr;
     if (sd_device_new_from_path(&current, path.data()) != 0)
@@ -24,7 +37,7 @@ std::optional<std::string> find_usb_device(std::string_view path)
     }
 
     // Check the chain and see if it matches the expected chain for a USB HID device
-    for (auto& [subsys, driver]: subsys_driver_chain)
+    for (auto& [subsys, driver]: chain)
     {
         const char *device_subsys, *device_driver = "";
         if (sd_device_get_subsystem(current, &device_subsys) != 0)
@@ -45,6 +58,101 @@ std::optional<std::string> find_usb_device(std::string_view path)
     return syspath;
 }
 
+std::optional<std::string> find_usb_device(std::string_view path)
+{
+    return find_usb_device(path, subsys_driver_chain);
+}
+
+std::optional<std::string> find_usb_device_from_hidraw(std::string_view path)
+{
+    return find_usb_device(path, hidraw_subsys_driver_chain);
+}
+
+static std::optional<std::string> read_sysfs_file(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return {};
+    return std::string(std::istreambuf_iterator<char>(file), {});
+}
+
+// HID interfaces have one interrupt IN endpoint, and maybe an OUT one
+static std::optional<std::uint8_t> find_interrupt_in_endpoint(const char* interface_syspath)
+{
+    glob_t glob_result;
+    std::optional<std::uint8_t> found;
+    if (glob(std::format("{}/ep_*", interface_syspath).c_str(), 0, nullptr, &glob_result) == 0)
+    {
+        for (std::size_t i = 0; i < glob_result.gl_pathc && !found; ++i)
+        {
+            std::string endpoint_path = glob_result.gl_pathv[i];
+            auto type = read_sysfs_file(endpoint_path + "/type");
+            auto address = read_sysfs_file(endpoint_path + "/bEndpointAddress");
+            if (!type || !address || !type->starts_with("Interrupt"))
+                continue;
+            auto value = std::strtoul(address->c_str(), nullptr, 16);
+            if (value & 0x80)
+                found = value;
+        }
+        globfree(&glob_result);
+    }
+    return found;
+}
+
+std::vector<usb_hid_interface> enumerate_usb_hid_interfaces()
+{
+    std::vector<usb_hid_interface> result;
+    __attribute__((cleanup(sd_device_enumerator_unrefp))) sd_device_enumerator* enumerator = nullptr;
+    if (sd_device_enumerator_new(&enumerator) < 0)
+        return result;
+    sd_device_enumerator_add_match_subsystem(enumerator, "hid", true);
+    for (
+        auto hid = sd_device_enumerator_get_device_first(enumerator);
+        hid;
+        hid = sd_device_enumerator_get_device_next(enumerator)
+    )
+    {
+        // Only HID devices right on a USB interface. Bluetooth and I2C ones
+        // have no USB parent, and the devices a receiver like logitech-dj
+        // creates below its own hang off a HID device, not the interface.
+        sd_device *interface, *usb_device;
+        const char *subsystem, *devtype;
+        if (
+            sd_device_get_parent(hid, &interface) != 0 ||
+            sd_device_get_subsystem(interface, &subsystem) != 0 ||
+            sd_device_get_devtype(interface, &devtype) != 0 ||
+            std::strcmp(subsystem, "usb") != 0 ||
+            std::strcmp(devtype, "usb_interface") != 0 ||
+            sd_device_get_parent_with_subsystem_devtype(interface, "usb", "usb_device", &usb_device) != 0
+        )
+            continue;
+
+        const char *hid_syspath, *interface_syspath, *usb_syspath;
+        sd_device_get_syspath(hid, &hid_syspath);
+        sd_device_get_syspath(interface, &interface_syspath);
+        sd_device_get_syspath(usb_device, &usb_syspath);
+
+        const char *busnum, *devnum;
+        if (
+            sd_device_get_sysattr_value(usb_device, "busnum", &busnum) != 0 ||
+            sd_device_get_sysattr_value(usb_device, "devnum", &devnum) != 0
+        )
+            continue;
+        auto endpoint = find_interrupt_in_endpoint(interface_syspath);
+        auto descriptor = read_sysfs_file(std::format("{}/report_descriptor", hid_syspath));
+        if (!endpoint || !descriptor)
+            continue;
+        result.push_back(usb_hid_interface{
+            .usb_device = usb_syspath,
+            .busnum = static_cast<std::uint16_t>(std::strtoul(busnum, nullptr, 10)),
+            .devnum = static_cast<std::uint8_t>(std::strtoul(devnum, nullptr, 10)),
+            .endpoint = *endpoint,
+            .report_descriptor = std::vector<unsigned char>(descriptor->begin(), descriptor->end())
+        });
+    }
+    return result;
+}
+
 std::optional<UsbDeviceInfo> get_usb_device_info(std::string_view path)
 {
     sd_device *device = nullptr;
@@ -124,3 +232,41 @@ std::string device_name_from_path(std::string_view path)
     }
     return name;
 }
+
+std::string device_name_from_hidraw(std::string_view path)
+{
+    sd_device *device = nullptr;
+    __attribute__((cleanup(sd_device_unrefp))) sd_device *parent = nullptr;
+
+    if (sd_device_new_from_path(&device, path.data()) != 0)
+    {
+        return "Unknown";
+    }
+    if (sd_device_get_parent(device, &parent) != 0)
+    {
+        return "Unknown";
+    }
+    // hid devices don't have a name attribute, the name is in the uevent
+    const char* name;
+    if (sd_device_get_property_value(parent, "HID_NAME", &name) != 0)
+    {
+        return "Unknown";
+    }
+    return name;
+}
+
+std::string device_name_from_usb(std::string_view syspath)
+{
+    __attribute__((cleanup(sd_device_unrefp))) sd_device *device = nullptr;
+
+    if (sd_device_new_from_syspath(&device, syspath.data()) != 0)
+    {
+        return "Unknown";
+    }
+    const char* name;
+    if (sd_device_get_sysattr_value(device, "product", &name) != 0)
+    {
+        return "Unknown";
+    }
+    return name;
+}
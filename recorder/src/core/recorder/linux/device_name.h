@@ -1,7 +1,25 @@
 #include <device.h>
+#include <cstdint>
 #include <string>
 #include <optional>
+#include <vector>
+
+// The HID interface of a USB device, as seen from the USB bus
+struct usb_hid_interface
+{
+    std::string usb_device;
+    std::uint16_t busnum;
+    std::uint8_t devnum;
+    // Address of the interrupt IN endpoint the interface reports on
+    std::uint8_t endpoint;
+    std::vector<unsigned char> report_descriptor;
+};
 
 std::optional<std::string> find_usb_device(std::string_view path);
+std::optional<std::string> find_usb_device_from_hidraw(std::string_view path);
+// Every HID device that sits on a USB interface, walks sysfs
+std::vector<usb_hid_interface> enumerate_usb_hid_interfaces();
 std::optional<UsbDeviceInfo> get_usb_device_info(std::string_view path);
 std::string device_name_from_path(std::string_view syspath);
+std::string device_name_from_hidraw(std::string_view path);
+std::string device_name_from_usb(std::string_view syspath);
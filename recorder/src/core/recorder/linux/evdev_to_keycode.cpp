@@ -135,17 +135,50 @@ constexpr auto evdev_mouse_to_keycode = []() {
     arr[BTN_LEFT    - BTN_LEFT] = Keycode::LeftClick;
     arr[BTN_RIGHT   - BTN_LEFT] = Keycode::RightClick;
     arr[BTN_MIDDLE  - BTN_LEFT] = Keycode::MiddleClick;
+    // Most mice report their side buttons as BTN_SIDE and BTN_EXTRA, which is
+    // what hid-input makes of HID buttons 4 and 5. Only a few use BTN_BACK
+    // and BTN_FORWARD.
+    arr[BTN_SIDE    - BTN_LEFT] = Keycode::MouseBack;
+    arr[BTN_EXTRA   - BTN_LEFT] = Keycode::MouseForward;
     arr[BTN_FORWARD - BTN_LEFT] = Keycode::MouseForward;
     arr[BTN_BACK    - BTN_LEFT] = Keycode::MouseBack;
 
     return arr;
 }();
 
+constexpr auto evdev_gamepad_to_keycode = []() {
+    std::array<Keycode, BTN_THUMBR - BTN_JOYSTICK + 1> arr{Keycode::None};
+
+    // Gamepad buttons first, in the order of the Linux gamepad spec
+    for (int i = BTN_SOUTH; i <= BTN_THUMBR; ++i)
+        arr[i - BTN_JOYSTICK] = static_cast<Keycode>(static_cast<int>(Keycode::Button1) + i - BTN_SOUTH);
+    // Joysticks use their own range, they get the buttons after that
+    for (int i = BTN_TRIGGER; i <= BTN_BASE6; ++i)
+        arr[i - BTN_JOYSTICK] = static_cast<Keycode>(static_cast<int>(Keycode::Button16) + i - BTN_TRIGGER);
+
+    return arr;
+}();
+
+constexpr auto evdev_dpad_to_keycode = []() {
+    std::array<Keycode, BTN_DPAD_RIGHT - BTN_DPAD_UP + 1> arr{Keycode::None};
+
+    arr[BTN_DPAD_UP    - BTN_DPAD_UP] = Keycode::HatN;
+    arr[BTN_DPAD_DOWN  - BTN_DPAD_UP] = Keycode::HatS;
+    arr[BTN_DPAD_LEFT  - BTN_DPAD_UP] = Keycode::HatW;
+    arr[BTN_DPAD_RIGHT - BTN_DPAD_UP] = Keycode::HatE;
+
+    return arr;
+}();
+
 Keycode evdev_to_keycode(std::uint16_t code)
 {
     if (code < 256)
         return evdev_keyboard_to_keycode[code];
     if (code >= BTN_LEFT && code <= BTN_TASK)
         return evdev_mouse_to_keycode[code - BTN_LEFT];
+    if (code >= BTN_JOYSTICK && code <= BTN_THUMBR)
+        return evdev_gamepad_to_keycode[code - BTN_JOYSTICK];
+    if (code >= BTN_DPAD_UP && code <= BTN_DPAD_RIGHT)
+        return evdev_dpad_to_keycode[code - BTN_DPAD_UP];
     return Keycode::None;
 }
@@ -0,0 +1,238 @@
+#include "hid_descriptor.h"
+#include <unordered_map>
+
+namespace {
+
+// Item tags, see HID 1.11 section 6.2.2
+enum item_type: std::uint8_t
+{
+    ITEM_MAIN = 0,
+    ITEM_GLOBAL = 1,
+    ITEM_LOCAL = 2,
+};
+
+enum main_tag: std::uint8_t
+{
+    MAIN_INPUT = 0x8,
+    MAIN_OUTPUT = 0x9,
+    MAIN_COLLECTION = 0xA,
+    MAIN_FEATURE = 0xB,
+    MAIN_END_COLLECTION = 0xC,
+};
+
+enum global_tag: std::uint8_t
+{
+    GLOBAL_USAGE_PAGE = 0x0,
+    GLOBAL_LOGICAL_MIN = 0x1,
+    GLOBAL_LOGICAL_MAX = 0x2,
+    GLOBAL_REPORT_SIZE = 0x7,
+    GLOBAL_REPORT_ID = 0x8,
+    GLOBAL_REPORT_COUNT = 0x9,
+    GLOBAL_PUSH = 0xA,
+    GLOBAL_POP = 0xB,
+};
+
+enum local_tag: std::uint8_t
+{
+    LOCAL_USAGE = 0x0,
+    LOCAL_USAGE_MIN = 0x1,
+    LOCAL_USAGE_MAX = 0x2,
+};
+
+constexpr std::uint8_t COLLECTION_APPLICATION = 0x01;
+constexpr std::uint8_t INPUT_CONSTANT = 0x01;
+constexpr std::uint8_t INPUT_VARIABLE = 0x02;
+
+struct global_state
+{
+    std::uint16_t usage_page = 0;
+    std::int32_t logical_min = 0;
+    std::int32_t logical_max = 0;
+    std::uint32_t report_size = 0;
+    std::uint32_t report_count = 0;
+    std::uint8_t report_id = 0;
+};
+
+// Usages shorter than 4 bytes get the usage page that is current at the main
+// item, not at the usage itself
+struct local_usage
+{
+    std::uint32_t value;
+    bool extended;
+};
+
+struct local_state
+{
+    std::vector<local_usage> usages;
+    std::optional<local_usage> usage_min;
+    std::optional<local_usage> usage_max;
+};
+
+std::uint32_t resolve(local_usage usage, std::uint16_t page)
+{
+    return usage.extended ? usage.value : hid_usage(page, usage.value);
+}
+
+std::int32_t sign_extend(std::uint32_t value, std::uint32_t bits)
+{
+    if (bits == 0 || bits >= 32)
+        return static_cast<std::int32_t>(value);
+    std::uint32_t sign = 1u << (bits - 1);
+    return static_cast<std::int32_t>((value ^ sign) - sign);
+}
+
+}
+
+std::optional<std::uint32_t> hid_field::usage(std::uint32_t n) const
+{
+    if (n < usages.size())
+        return usages[n];
+    if (usage_max && usage_min + n <= usage_max)
+        return usage_min + n;
+    // a variable field with fewer usages than values repeats the last one
+    if (variable && !usages.empty())
+        return usages.back();
+    return {};
+}
+
+std::int32_t hid_field::value(std::span<const unsigned char> report, std::uint32_t n) const
+{
+    std::uint32_t offset = bit_offset + n * bit_size;
+    std::uint32_t raw = 0;
+    for (std::uint32_t i = 0; i < bit_size && i < 32; ++i)
+    {
+        std::uint32_t bit = offset + i;
+        if (bit / 8 >= report.size())
+            break;
+        raw |= static_cast<std::uint32_t>(report[bit / 8] >> (bit % 8) & 1) << i;
+    }
+    return logical_min < 0 ? sign_extend(raw, bit_size) : static_cast<std::int32_t>(raw);
+}
+
+std::optional<hid_report_descriptor> parse_hid_report_descriptor(std::span<const unsigned char> descriptor)
+{
+    hid_report_descriptor result;
+    global_state global;
+    std::vector<global_state> global_stack;
+    local_state local;
+    std::vector<std::uint32_t> collections;
+    std::uint32_t application = 0;
+    // Input fields of every report are laid out one after another
+    std::unordered_map<std::uint8_t, std::uint32_t> input_offsets;
+
+    std::size_t pos = 0;
+    while (pos < descriptor.size())
+    {
+        std::uint8_t prefix = descriptor[pos++];
+        // long items aren't used by any defined tag, skip them
+        if (prefix == 0xFE)
+        {
+            if (pos + 2 > descriptor.size())
+                return {};
+            pos += 2 + descriptor[pos];
+            continue;
+        }
+        std::size_t size = prefix & 0x3;
+        if (size == 3)
+            size = 4;
+        if (pos + size > descriptor.size())
+            return {};
+        std::uint32_t data = 0;
+        for (std::size_t i = 0; i < size; ++i)
+            data |= static_cast<std::uint32_t>(descriptor[pos + i]) << (8 * i);
+        pos += size;
+        auto sdata = sign_extend(data, size * 8);
+        std::uint8_t type = (prefix >> 2) & 0x3;
+        std::uint8_t tag = prefix >> 4;
+
+        if (type == ITEM_GLOBAL)
+        {
+            switch (tag)
+            {
+                case GLOBAL_USAGE_PAGE: global.usage_page = data; break;
+                case GLOBAL_LOGICAL_MIN: global.logical_min = sdata; break;
+                case GLOBAL_LOGICAL_MAX:
+                    // a non-negative minimum means the maximum is unsigned too
+                    global.logical_max = global.logical_min >= 0 ? static_cast<std::int32_t>(data) : sdata;
+                    break;
+                case GLOBAL_REPORT_SIZE: global.report_size = data; break;
+                case GLOBAL_REPORT_ID:
+                    global.report_id = data;
+                    result.report_ids = true;
+                    break;
+                case GLOBAL_REPORT_COUNT: global.report_count = data; break;
+                case GLOBAL_PUSH: global_stack.push_back(global); break;
+                case GLOBAL_POP:
+                    if (global_stack.empty())
+                        return {};
+                    global = global_stack.back();
+                    global_stack.pop_back();
+                    break;
+            }
+        }
+        else if (type == ITEM_LOCAL)
+        {
+            local_usage usage{ data, size == 4 };
+            switch (tag)
+            {
+                case LOCAL_USAGE: local.usages.push_back(usage); break;
+                case LOCAL_USAGE_MIN: local.usage_min = usage; break;
+                case LOCAL_USAGE_MAX: local.usage_max = usage; break;
+            }
+        }
+        else if (type == ITEM_MAIN)
+        {
+            switch (tag)
+            {
+                case MAIN_COLLECTION:
+                {
+                    std::uint32_t usage = local.usages.empty() ? 0 : resolve(local.usages.front(), global.usage_page);
+                    if (collections.empty() && data == COLLECTION_APPLICATION)
+                        application = usage;
+                    collections.push_back(usage);
+                    break;
+                }
+                case MAIN_END_COLLECTION:
+                    if (collections.empty())
+                        return {};
+                    collections.pop_back();
+                    if (collections.empty())
+                        application = 0;
+                    break;
+                case MAIN_INPUT:
+                {
+                    auto& offset = input_offsets[global.report_id];
+                    std::uint32_t bits = global.report_size * global.report_count;
+                    if (!(data & INPUT_CONSTANT) && bits)
+                    {
+                        hid_field field{
+                            .report_id = global.report_id,
+                            .bit_offset = offset,
+                            .bit_size = global.report_size,
+                            .count = global.report_count,
+                            .variable = (data & INPUT_VARIABLE) != 0,
+                            .logical_min = global.logical_min,
+                            .logical_max = global.logical_max,
+                            .application = application
+                        };
+                        for (auto& usage: local.usages)
+                            field.usages.push_back(resolve(usage, global.usage_page));
+                        if (local.usage_min && local.usage_max)
+                        {
+                            field.usage_min = resolve(*local.usage_min, global.usage_page);
+                            field.usage_max = resolve(*local.usage_max, global.usage_page);
+                        }
+                        result.inputs.push_back(std::move(field));
+                    }
+                    offset += bits;
+                    break;
+                }
+                case MAIN_OUTPUT:
+                case MAIN_FEATURE:
+                    break;
+            }
+            local = {};
+        }
+    }
+    return result;
+}
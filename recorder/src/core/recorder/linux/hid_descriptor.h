@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+// Usages are stored extended, usage page in the high 16 bits
+constexpr std::uint32_t hid_usage(std::uint16_t page, std::uint16_t id)
+{
+    return static_cast<std::uint32_t>(page) << 16 | id;
+}
+
+constexpr std::uint16_t HID_PAGE_GENERIC_DESKTOP = 0x01;
+constexpr std::uint16_t HID_PAGE_KEYBOARD = 0x07;
+constexpr std::uint16_t HID_PAGE_BUTTON = 0x09;
+
+constexpr std::uint32_t HID_USAGE_POINTER = hid_usage(HID_PAGE_GENERIC_DESKTOP, 0x01);
+constexpr std::uint32_t HID_USAGE_MOUSE = hid_usage(HID_PAGE_GENERIC_DESKTOP, 0x02);
+constexpr std::uint32_t HID_USAGE_JOYSTICK = hid_usage(HID_PAGE_GENERIC_DESKTOP, 0x04);
+constexpr std::uint32_t HID_USAGE_GAMEPAD = hid_usage(HID_PAGE_GENERIC_DESKTOP, 0x05);
+constexpr std::uint32_t HID_USAGE_KEYBOARD = hid_usage(HID_PAGE_GENERIC_DESKTOP, 0x06);
+constexpr std::uint32_t HID_USAGE_KEYPAD = hid_usage(HID_PAGE_GENERIC_DESKTOP, 0x07);
+
+// One Input main item of a report descriptor
+struct hid_field
+{
+    std::uint8_t report_id = 0;
+    // Position in the report, not counting the report ID byte
+    std::uint32_t bit_offset = 0;
+    std::uint32_t bit_size = 0;
+    std::uint32_t count = 0;
+    // Variable fields have one value per usage, array fields list the usages that are active
+    bool variable = false;
+    std::int32_t logical_min = 0;
+    std::int32_t logical_max = 0;
+    // Usage of the top level application collection the field is in
+    std::uint32_t application = 0;
+    std::vector<std::uint32_t> usages;
+    std::uint32_t usage_min = 0;
+    std::uint32_t usage_max = 0;
+
+    // Usage of the n-th value (variable) or of the value n after logical_min (array)
+    std::optional<std::uint32_t> usage(std::uint32_t n) const;
+    // Raw value of the n-th element, sign extended if the logical range is signed
+    std::int32_t value(std::span<const unsigned char> report, std::uint32_t n) const;
+};
+
+struct hid_report_descriptor
+{
+    // If set, every report starts with a report ID byte
+    bool report_ids = false;
+    std::vector<hid_field> inputs;
+};
+
+// Constant (padding) fields are left out. Returns nothing if the descriptor is malformed.
+std::optional<hid_report_descriptor> parse_hid_report_descriptor(std::span<const unsigned char> descriptor);
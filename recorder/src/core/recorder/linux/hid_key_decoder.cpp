@@ -0,0 +1,166 @@
+#include "hid_key_decoder.h"
+#include <algorithm>
+#include <array>
+#include <iterator>
+
+namespace {
+
+constexpr std::uint32_t hid_keyboard_first = 0x04;
+constexpr std::uint32_t hid_keyboard_last = 0xE7;
+constexpr std::uint32_t hid_error_rollover = hid_usage(HID_PAGE_KEYBOARD, 0x01);
+constexpr std::uint32_t hid_gamepad_buttons = 32;
+
+// Buttons 4 and 5 are the side buttons, hid-input maps them to BTN_SIDE and
+// BTN_EXTRA, which the evdev backends record as the same keycodes
+constexpr std::array<Keycode, 5> hid_mouse_buttons = {
+    Keycode::LeftClick, Keycode::RightClick, Keycode::MiddleClick,
+    Keycode::MouseBack, Keycode::MouseForward
+};
+
+}
+
+hid_key_decoder::hid_key_decoder(hid_report_descriptor descriptor, bool keyboard, bool mouse, bool gamepad):
+    m_descriptor(std::move(descriptor)), m_keyboard(keyboard), m_mouse(mouse), m_gamepad(gamepad)
+{
+    std::erase_if(m_descriptor.inputs, [this](const hid_field& field) {
+        auto relevant = [&](std::uint32_t usage) { return _to_keycode(field, usage).has_value(); };
+        return std::none_of(field.usages.begin(), field.usages.end(), relevant) &&
+            !(field.usage_max && _overlaps(field));
+    });
+}
+
+bool hid_key_decoder::empty() const
+{
+    return m_descriptor.inputs.empty();
+}
+
+std::optional<hid_key_decoder::id_range> hid_key_decoder::_mapped_ids(const hid_field& field, std::uint16_t page) const
+{
+    if (page == HID_PAGE_KEYBOARD)
+    {
+        if (!m_keyboard)
+            return {};
+        return id_range{ hid_keyboard_first, hid_keyboard_last };
+    }
+    if (page == HID_PAGE_BUTTON)
+    {
+        // the same usage page is used for mouse and gamepad buttons, the
+        // application collection tells them apart
+        if (field.application == HID_USAGE_MOUSE || field.application == HID_USAGE_POINTER)
+        {
+            if (!m_mouse)
+                return {};
+            return id_range{ 1, hid_mouse_buttons.size() };
+        }
+        if (field.application == HID_USAGE_JOYSTICK || field.application == HID_USAGE_GAMEPAD)
+        {
+            if (!m_gamepad)
+                return {};
+            return id_range{ 1, hid_gamepad_buttons };
+        }
+    }
+    return {};
+}
+
+// Keyboards commonly declare their key array as usages 0x00-0xFF, neither
+// end of which is a key, so the whole range is clamped to the mapped one
+bool hid_key_decoder::_overlaps(const hid_field& field) const
+{
+    std::uint16_t page = field.usage_min >> 16;
+    if (field.usage_max >> 16 != page)
+        return false;
+    auto ids = _mapped_ids(field, page);
+    if (!ids)
+        return false;
+    auto first = std::max<std::uint32_t>(field.usage_min & 0xFFFF, ids->first);
+    auto last = std::min<std::uint32_t>(field.usage_max & 0xFFFF, ids->last);
+    return first <= last;
+}
+
+std::optional<Keycode> hid_key_decoder::_to_keycode(const hid_field& field, std::uint32_t usage) const
+{
+    std::uint16_t page = usage >> 16;
+    std::uint16_t id = usage & 0xFFFF;
+    auto ids = _mapped_ids(field, page);
+    if (!ids || id < ids->first || id > ids->last)
+        return {};
+    if (page == HID_PAGE_KEYBOARD)
+        return static_cast<Keycode>(id);
+    if (field.application == HID_USAGE_MOUSE || field.application == HID_USAGE_POINTER)
+        return hid_mouse_buttons[id - 1];
+    return static_cast<Keycode>(static_cast<int>(Keycode::Button1) + id - 1);
+}
+
+std::vector<hid_key_decoder::transition> hid_key_decoder::update(std::span<const unsigned char> report)
+{
+    std::uint8_t report_id = 0;
+    if (m_descriptor.report_ids)
+    {
+        if (report.empty())
+            return {};
+        report_id = report[0];
+        report = report.subspan(1);
+    }
+
+    std::vector<Keycode> state;
+    bool has_fields = false;
+    for (auto& field: m_descriptor.inputs)
+    {
+        if (field.report_id != report_id)
+            continue;
+        has_fields = true;
+        for (std::uint32_t n = 0; n < field.count; ++n)
+        {
+            std::optional<std::uint32_t> usage;
+            if (field.variable)
+            {
+                if (field.value(report, n) == 0)
+                    continue;
+                usage = field.usage(n);
+            }
+            else
+            {
+                // array fields list the usages that are active, as an index
+                // into the usages of the field
+                auto value = field.value(report, n);
+                if (value < field.logical_min || value > field.logical_max)
+                    continue;
+                usage = field.usage(value - field.logical_min);
+                // too many keys are held for the keyboard to tell which ones,
+                // the report says nothing about the key state
+                if (usage == hid_error_rollover)
+                    return {};
+            }
+            if (!usage)
+                continue;
+            if (auto code = _to_keycode(field, *usage))
+                state.push_back(*code);
+        }
+    }
+    if (!has_fields)
+        return {};
+    std::sort(state.begin(), state.end());
+    state.erase(std::unique(state.begin(), state.end()), state.end());
+
+    auto& state_prev = m_pressed[report_id];
+    std::vector<Keycode> pressed;
+    std::vector<Keycode> released;
+    std::set_difference(
+        state_prev.begin(), state_prev.end(),
+        state.begin(), state.end(),
+        std::back_inserter(released)
+    );
+    std::set_difference(
+        state.begin(), state.end(),
+        state_prev.begin(), state_prev.end(),
+        std::back_inserter(pressed)
+    );
+    state_prev = std::move(state);
+
+    std::vector<transition> transitions;
+    for (auto code: released)
+        transitions.push_back({ code, false });
+    for (auto code: pressed)
+        transitions.push_back({ code, true });
+    return transitions;
+}
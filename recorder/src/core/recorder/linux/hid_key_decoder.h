@@ -0,0 +1,49 @@
+#pragma once
+
+#include "hid_descriptor.h"
+#include <keycode.h>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+// Turns the input reports of a HID device into key transitions, by diffing
+// the keys held in each report against the previous report with the same ID
+class hid_key_decoder
+{
+public:
+    struct transition
+    {
+        Keycode code;
+        bool pressed;
+    };
+
+    // Only the fields holding the requested kinds of keys are kept
+    hid_key_decoder(hid_report_descriptor descriptor, bool keyboard, bool mouse, bool gamepad);
+    // Set if the device has none of the requested keys
+    bool empty() const;
+    // The report includes the report ID byte, if the device uses them
+    std::vector<transition> update(std::span<const unsigned char> report);
+
+private:
+    // Inclusive
+    struct id_range
+    {
+        std::uint32_t first;
+        std::uint32_t last;
+    };
+
+    // The usage IDs of a page that map to one of the requested keys
+    std::optional<id_range> _mapped_ids(const hid_field& field, std::uint16_t page) const;
+    // Whether a usage range field holds any of the requested keys
+    bool _overlaps(const hid_field& field) const;
+    std::optional<Keycode> _to_keycode(const hid_field& field, std::uint32_t usage) const;
+
+    hid_report_descriptor m_descriptor;
+    bool m_keyboard;
+    bool m_mouse;
+    bool m_gamepad;
+    // Keys held down as of the last report, per report ID, sorted
+    std::unordered_map<std::uint8_t, std::vector<Keycode>> m_pressed;
+};
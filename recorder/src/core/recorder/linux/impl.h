@@ -1,30 +1,360 @@
 #include "../recorder_impl.h"
+#include "hid_key_decoder.h"
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <thread>
+#include <span>
+#include <unordered_map>
+#include <vector>
 #include <boost/unordered/concurrent_flat_map.hpp>
 #include <libevdev/libevdev.h>
+#include <liburing.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <systemd/sd-device.h>
 
 struct internal_device
 {
     libevdev* event_device = nullptr;
     std::string syspath;
+    // Index of the reader thread that owns this device
+    unsigned shard = 0;
+    std::uint16_t vid = 0;
+    std::uint16_t pid = 0;
+    // Events are read straight from the fd, so libevdev never sees them and
+    // can't resync for us. Keep our own key state to diff against instead.
+    std::bitset<KEY_CNT> key_state;
+    // Key transitions of the current frame, they are emitted on SYN_REPORT
+    // once the whole frame, including its MSC_TIMESTAMP, has been read
+    struct pending_key
+    {
+        std::uint64_t timestamp;
+        std::uint16_t code;
+        bool pressed;
+    };
+    std::vector<pending_key> frame_keys;
+    // Number of the last frame, every SYN_REPORT starts a new one
+    std::uint32_t frame = 0;
+    // MSC_TIMESTAMP is a 32 bit microsecond counter that wraps around,
+    // device_clock is it unwrapped to 64 bits
+    std::optional<std::uint64_t> frame_device_timestamp;
+    // Relative motion of the current frame
+    std::int32_t frame_dx = 0;
+    std::int32_t frame_dy = 0;
+    bool frame_motion = false;
+    // Gamepad axes that changed in the current frame, with their raw values
+    std::vector<std::pair<GamepadAxis, std::int32_t>> frame_axes;
+    // Minimum and maximum of each GamepadAxis
+    std::array<std::pair<std::int32_t, std::int32_t>, 6> axis_range{};
+    // Motion being coalesced, not emitted yet
+    struct pending_motion
+    {
+        std::uint64_t start;
+        std::uint64_t timestamp;
+        std::uint32_t frame;
+        std::optional<std::uint64_t> device_timestamp;
+        std::optional<std::uint64_t> receive_timestamp;
+        std::int32_t dx;
+        std::int32_t dy;
+        std::uint32_t reports;
+    };
+    std::optional<pending_motion> motion;
+    std::optional<std::uint64_t> device_clock;
+    std::uint32_t device_clock_raw = 0;
+    // When the events being processed were read, only set in busy poll mode
+    std::optional<std::uint64_t> receive_timestamp;
+    // Time of the SYN_DROPPED that started the current gap
+    std::uint64_t drop_timestamp = 0;
+    bool dropped = false;
+    Recorder::Impl::DeviceSink sink;
+    // Inputs and axis samples of the current read, handed over together by _deliver
+    std::vector<Input> batch;
+    std::vector<AxisSample> axis_batch;
+    // Set by the reader once it has started watching the device
+    bool watched = false;
     bool remove = false;
 };
 
 class recorder_linux_libevdev: public Recorder::Impl
 {
 public:
-    recorder_linux_libevdev(std::shared_ptr<spdlog::logger> logger);
-    virtual void Start(bool kseyboard, bool mouse, bool gamepad);
+    recorder_linux_libevdev(std::shared_ptr<spdlog::logger> logger, const RecorderOptions& options);
+    virtual void Start(bool keyboard, bool mouse, bool gamepad);
     virtual void Stop();
+    virtual void Shutdown();
     virtual std::string GetDeviceName(std::string_view id) const;
     virtual std::optional<std::string> GetUsbDeviceId(std::string_view id) const;
     virtual std::optional<UsbDeviceInfo> GetUsbDeviceInfo(std::string_view id) const;
+    virtual RealTimeStatus GetRealTimeStatus() const;
+    virtual std::optional<CaptureClock> GetCaptureClock() const;
 
-private:
-    using EvdevDeviceMap = boost::unordered::concurrent_flat_map<std::string, internal_device>;
+protected:
+    // Every reader thread owns a subset of the devices and waits on them by
+    // itself, so a busy device only delays the devices in its own shard
+    struct reader_shard
+    {
+        reader_shard();
+        virtual ~reader_shard();
+        unsigned index = 0;
+        int wakeup_fd = -1;
+        // Last warm standby pause this reader acknowledged
+        unsigned pause_generation = 0;
+        // The reader left its loop on an error, under m_pause_mutex
+        bool exited = false;
+        // Removed devices the setup thread replaced in the map because they
+        // were plugged back in before this reader closed them
+        std::mutex retired_mutex;
+        std::vector<std::unique_ptr<internal_device>> retired;
+        std::jthread thread;
+    };
+
+    // Devices are heap allocated so readers can hand their address to the kernel
+    using EvdevDeviceMap = boost::unordered::concurrent_flat_map<std::string, std::unique_ptr<internal_device>>;
     EvdevDeviceMap m_evdev_devices;
-    void _init_scan_devices();
-    void _init_poll(bool keyboard, bool mouse, bool gamepad);
-    std::jthread m_device_scan_thread;
-    std::jthread m_poll_thread;
-};
\ No newline at end of file
+
+    // Starts watching the devices of a shard the setup thread has opened, and
+    // closes removed ones. Called from the shard's reader thread.
+    void _sync_devices(reader_shard& shard);
+    void _process_events(internal_device& dev, std::span<const input_event> events);
+    // Hands the inputs the last _process_events produced to Recorder in one go
+    void _deliver(internal_device& dev);
+
+    // The way devices are waited on and read is what differs between readers
+    virtual std::unique_ptr<reader_shard> _create_shard();
+    virtual void _run_shard(reader_shard& shard, const std::stop_token& stop);
+    virtual bool _watch(reader_shard& shard, internal_device& dev);
+    virtual void _unwatch(reader_shard& shard, internal_device& dev);
+
+private:
+    struct epoll_shard: reader_shard
+    {
+        ~epoll_shard();
+        int epoll_fd = -1;
+        // The watched devices, busy polling reads them without asking epoll
+        std::vector<internal_device*> devices;
+    };
+
+    bool _read_device(reader_shard& shard, internal_device& dev);
+    void _run_busy_poll(epoll_shard& shard, const std::stop_token& stop);
+    void _arm();
+    void _disarm();
+    void _pause_readers();
+    void _init_readers();
+    void _init_setup_thread();
+    void _receive_hotplug();
+    std::unique_ptr<internal_device> _open_device(const std::string& path);
+    void _add_device(const std::string& id);
+    void _remove_device(const std::string& id);
+    void _close_device(reader_shard& shard, internal_device& dev);
+    void _init_realtime_thread();
+    unsigned _shard_of(std::string_view path) const;
+    void _wake(unsigned shard);
+    void _emit(
+        internal_device& dev, std::uint64_t timestamp, std::uint16_t code, bool pressed,
+        std::optional<std::uint64_t> device_timestamp = std::nullopt
+    );
+    void _emit_motion(internal_device& dev, std::uint64_t timestamp);
+    void _emit_axis(internal_device& dev, std::uint64_t timestamp, GamepadAxis axis, std::int32_t value);
+    void _flush_motion(internal_device& dev);
+    std::optional<std::uint64_t> _receive_timestamp(const internal_device& dev) const;
+    void _resync(internal_device& dev, std::uint64_t timestamp);
+    RecorderOptions m_options;
+    clockid_t m_clock;
+    bool m_keyboard = true;
+    bool m_mouse = false;
+    bool m_gamepad = false;
+    // Read by the readers while Start sets it in warm standby
+    std::atomic<std::uint64_t> m_ref_usec = 0;
+    // Inputs are only emitted while it's set. In warm standby the readers
+    // keep running between recordings and just drop what they read.
+    std::atomic<bool> m_capturing = false;
+    // Readers and devices are up, which outlasts Stop in warm standby
+    bool m_armed = false;
+    // Bumped by a warm Stop, each reader that is still running acknowledges
+    // it on m_pause_done. The mutex keeps readers from exiting unnoticed while
+    // a pause is set up.
+    std::atomic<unsigned> m_pause_generation = 0;
+    std::unique_ptr<std::latch> m_pause_done;
+    std::mutex m_pause_mutex;
+    std::vector<std::unique_ptr<reader_shard>> m_shards;
+    // Opens and probes new devices, off the reader threads
+    std::jthread m_setup_thread;
+    sd_device_monitor* m_monitor = nullptr;
+    int m_setup_wakeup_fd = -1;
+
+    // Start waits for every capture thread to apply the real-time settings,
+    // so the status is final once it returns
+    std::unique_ptr<std::latch> m_realtime_ready;
+    bool m_realtime_memory_locked = false;
+    std::atomic<bool> m_realtime_scheduler = false;
+    std::atomic<bool> m_realtime_timer_slack = false;
+};
+
+class recorder_linux_io_uring: public recorder_linux_libevdev
+{
+public:
+    recorder_linux_io_uring(std::shared_ptr<spdlog::logger> logger, const RecorderOptions& options);
+
+protected:
+    virtual std::unique_ptr<reader_shard> _create_shard();
+    virtual void _run_shard(reader_shard& shard, const std::stop_token& stop);
+    virtual bool _watch(reader_shard& shard, internal_device& dev);
+    virtual void _unwatch(reader_shard& shard, internal_device& dev);
+
+private:
+    // Completions are matched to devices by fd. The generation is bumped every
+    // time a fd is (un)watched, so completions for a closed device are ignored
+    // even if its fd number has been reused since.
+    struct uring_slot
+    {
+        internal_device* device = nullptr;
+        std::uint32_t generation = 0;
+    };
+
+    // Tearing down the ring cancels every read that is still armed
+    struct uring_shard: reader_shard
+    {
+        ~uring_shard();
+        io_uring ring;
+        bool ring_initialized = false;
+        io_uring_buf_ring* buf_ring = nullptr;
+        std::vector<input_event> buffers;
+        std::vector<uring_slot> slots;
+        eventfd_t wakeup_value = 0;
+    };
+
+    io_uring_sqe* _get_sqe(uring_shard& shard);
+    void _arm_read(uring_shard& shard, int fd);
+    void _arm_wakeup(uring_shard& shard);
+    void _recycle_buffer(uring_shard& shard, std::uint16_t id);
+    void _handle_read(uring_shard& shard, io_uring_cqe* cqe);
+
+    bool m_multishot = false;
+};
+struct hidraw_device
+{
+    std::string path;
+    int fd = -1;
+    std::uint16_t vid = 0;
+    std::uint16_t pid = 0;
+    std::optional<hid_key_decoder> keys;
+    std::uint32_t frame = 0;
+    Recorder::Impl::DeviceSink sink;
+    // Inputs and reports of the current wakeup, handed over together
+    std::vector<Input> batch;
+    std::vector<Report> report_batch;
+};
+
+class recorder_linux_hidraw: public Recorder::Impl
+{
+public:
+    recorder_linux_hidraw(std::shared_ptr<spdlog::logger> logger, const RecorderOptions& options);
+    virtual void Start(bool keyboard, bool mouse, bool gamepad);
+    virtual void Stop();
+    virtual std::string GetDeviceName(std::string_view id) const;
+    virtual std::optional<std::string> GetUsbDeviceId(std::string_view id) const;
+    virtual std::optional<UsbDeviceInfo> GetUsbDeviceInfo(std::string_view id) const;
+    virtual std::optional<CaptureClock> GetCaptureClock() const;
+
+private:
+    void _run(const std::stop_token& stop);
+    void _open_device(const std::string& path);
+    void _close_device(hidraw_device& dev);
+    void _process_report(hidraw_device& dev, std::span<const unsigned char> report, std::uint64_t timestamp);
+    void _receive_hotplug(std::vector<std::unique_ptr<hidraw_device>>& removed);
+
+    RecorderOptions m_options;
+    clockid_t m_clock;
+    bool m_keyboard = true;
+    bool m_mouse = false;
+    bool m_gamepad = false;
+    std::uint64_t m_ref_usec = 0;
+    int m_epoll_fd = -1;
+    int m_wakeup_fd = -1;
+    sd_device_monitor* m_monitor = nullptr;
+    // Only touched by the reader thread
+    std::unordered_map<std::string, std::unique_ptr<hidraw_device>> m_devices;
+    std::jthread m_reader_thread;
+};
+
+struct usbmon_device
+{
+    std::string syspath;
+    std::uint16_t vid = 0;
+    std::uint16_t pid = 0;
+    // Shared by all interfaces of the device
+    std::uint32_t frame = 0;
+    Recorder::Impl::DeviceSink sink;
+    // Inputs and reports of the current wakeup, handed over together
+    std::vector<Input> batch;
+    std::vector<Report> report_batch;
+};
+
+struct usbmon_endpoint
+{
+    usbmon_device* device;
+    hid_key_decoder keys;
+};
+
+// An endpoint as the scanner found it, the reader only sets up the ones it
+// doesn't track yet
+struct usbmon_scanned_endpoint
+{
+    std::string usb_device;
+    std::uint16_t vid = 0;
+    std::uint16_t pid = 0;
+    hid_report_descriptor descriptor;
+};
+// Keyed like recorder_linux_usbmon::m_endpoints
+using usbmon_scan = std::unordered_map<std::uint32_t, usbmon_scanned_endpoint>;
+
+class recorder_linux_usbmon: public Recorder::Impl
+{
+public:
+    recorder_linux_usbmon(std::shared_ptr<spdlog::logger> logger, const RecorderOptions& options);
+    virtual void Start(bool keyboard, bool mouse, bool gamepad);
+    virtual void Stop();
+    virtual std::string GetDeviceName(std::string_view id) const;
+    virtual std::optional<std::string> GetUsbDeviceId(std::string_view id) const;
+    virtual std::optional<UsbDeviceInfo> GetUsbDeviceInfo(std::string_view id) const;
+    virtual std::optional<CaptureClock> GetCaptureClock() const;
+
+private:
+    void _run(const std::stop_token& stop);
+    void _run_scanner(const std::stop_token& stop);
+    usbmon_scan _scan_devices(const usbmon_scan& previous) const;
+    void _apply_scan(const usbmon_scan& scan);
+    void _process_completion(
+        std::uint16_t busnum, std::uint8_t devnum, std::uint8_t endpoint,
+        std::uint64_t timestamp, std::span<const unsigned char> data
+    );
+
+    RecorderOptions m_options;
+    bool m_keyboard = true;
+    bool m_mouse = false;
+    bool m_gamepad = false;
+    // usbmon stamps URBs with the wall clock
+    std::uint64_t m_ref_usec = 0;
+    int m_usbmon_fd = -1;
+    int m_wakeup_fd = -1;
+    // Hotplug is handled by m_scanner_thread, the sysfs walks of a scan would
+    // hold up the reader
+    sd_device_monitor* m_monitor = nullptr;
+    int m_scanner_wakeup_fd = -1;
+    // Only touched by the scanner thread
+    usbmon_scan m_scanned;
+    // The latest scan, until the reader picks it up
+    std::mutex m_scan_mutex;
+    std::optional<usbmon_scan> m_pending_scan;
+    // Only touched by the reader thread
+    std::unordered_map<std::string, std::unique_ptr<usbmon_device>> m_devices;
+    // Keyed by bus << 16 | device address << 8 | endpoint address
+    std::unordered_map<std::uint32_t, usbmon_endpoint> m_endpoints;
+    std::jthread m_scanner_thread;
+    std::jthread m_reader_thread;
+};
@@ -0,0 +1,38 @@
+#include "realtime.h"
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+
+bool lock_memory()
+{
+    // MCL_FUTURE also covers the stacks of the capture threads created afterwards
+    return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+}
+
+void unlock_memory()
+{
+    munlockall();
+}
+
+// Applies to the calling thread only
+bool set_realtime_scheduler(int priority)
+{
+    sched_param param{
+        .sched_priority = std::clamp(
+            priority,
+            sched_get_priority_min(SCHED_FIFO),
+            sched_get_priority_max(SCHED_FIFO)
+        )
+    };
+    return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+}
+
+// Applies to the calling thread only. The slack is how late the kernel may
+// fire timers to coalesce wakeups, 1 ns is the smallest value it accepts.
+bool set_min_timer_slack()
+{
+    return prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0) == 0 &&
+        prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0) == 1;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// All of these need privileges (root, CAP_SYS_NICE/CAP_IPC_LOCK or a high
+// enough rlimit), and return whether the setting actually took effect
+bool lock_memory();
+void unlock_memory();
+bool set_realtime_scheduler(int priority);
+bool set_min_timer_slack();
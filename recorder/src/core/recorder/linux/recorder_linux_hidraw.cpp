@@ -0,0 +1,326 @@
+#include "impl.h"
+#include "clock.h"
+#include "device_name.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <iterator>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/hidraw.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <systemd/sd-device.h>
+
+// HID_MAX_BUFFER_SIZE of older kernels, newer ones allow more but no
+// keyboard or mouse comes close
+constexpr std::size_t max_report_size = 4096;
+
+// epoll data of the entries that don't belong to a device
+constexpr std::uint64_t wakeup_tag = 0;
+constexpr std::uint64_t monitor_tag = 1;
+
+recorder_linux_hidraw::recorder_linux_hidraw(std::shared_ptr<spdlog::logger> logger, const RecorderOptions& options):
+    Recorder::Impl(logger), m_options(options), m_clock(to_clockid(options.Clock))
+{
+    struct stat st;
+    if (stat("/sys/class/hidraw", &st) != 0)
+        throw std::runtime_error("hidraw is not available");
+}
+
+void recorder_linux_hidraw::_open_device(const std::string& path)
+{
+    if (m_devices.contains(path))
+        return;
+    int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+    {
+        m_logger->warn("Failed to open {}: {}", path, std::strerror(errno));
+        return;
+    }
+    auto dev = std::make_unique<hidraw_device>(hidraw_device{
+        .path = path,
+        .fd = fd
+    });
+
+    hidraw_devinfo info;
+    if (ioctl(fd, HIDIOCGRAWINFO, &info) == 0)
+    {
+        dev->vid = info.vendor;
+        dev->pid = info.product;
+    }
+
+    // The kernel hands out the report descriptor it parsed itself, which also
+    // covers Bluetooth and I2C devices that have no USB descriptors in sysfs
+    int size = 0;
+    hidraw_report_descriptor raw_descriptor{};
+    if (ioctl(fd, HIDIOCGRDESCSIZE, &size) != 0 || size <= 0 || size > HID_MAX_DESCRIPTOR_SIZE)
+    {
+        m_logger->warn("Failed to get the report descriptor size of {}", path);
+        close(fd);
+        return;
+    }
+    raw_descriptor.size = size;
+    if (ioctl(fd, HIDIOCGRDESC, &raw_descriptor) != 0)
+    {
+        m_logger->warn("Failed to get the report descriptor of {}", path);
+        close(fd);
+        return;
+    }
+    auto descriptor = parse_hid_report_descriptor(std::span(raw_descriptor.value, raw_descriptor.size));
+    if (!descriptor)
+    {
+        m_logger->warn("Failed to parse the report descriptor of {}", path);
+        close(fd);
+        return;
+    }
+
+    dev->keys.emplace(std::move(*descriptor), m_keyboard, m_mouse, m_gamepad);
+    if (dev->keys->empty())
+    {
+        m_logger->debug("Skipping {}, no keys or buttons were requested from it", path);
+        close(fd);
+        return;
+    }
+
+    epoll_event device_event{
+        .events = EPOLLIN,
+        .data = { .ptr = dev.get() }
+    };
+    if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &device_event) != 0)
+    {
+        m_logger->warn("Failed to watch {}", path);
+        close(fd);
+        return;
+    }
+    m_logger->debug("Opened {} ({:04x}:{:04x})", path, dev->vid, dev->pid);
+    m_devices.emplace(path, std::move(dev));
+}
+
+void recorder_linux_hidraw::_close_device(hidraw_device& dev)
+{
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, dev.fd, nullptr);
+    close(dev.fd);
+    dev.fd = -1;
+}
+
+void recorder_linux_hidraw::_process_report(
+    hidraw_device& dev, std::span<const unsigned char> report, std::uint64_t timestamp
+)
+{
+    ++dev.frame;
+    dev.report_batch.push_back(Report{
+        .Timestamp = timestamp,
+        .Frame = dev.frame,
+        .Data = m_options.KeepReportData ?
+            std::vector<unsigned char>(report.begin(), report.end()) :
+            std::vector<unsigned char>{}
+    });
+    for (auto [code, pressed]: dev.keys->update(report))
+    {
+        dev.batch.push_back(Input{
+            .Timestamp = timestamp,
+            .Pressed = pressed,
+            .Code = code,
+            .Frame = dev.frame
+        });
+    }
+}
+
+void recorder_linux_hidraw::_run(const std::stop_token& stop)
+{
+    // Nodes that are already there. Anything added from now on is queued on
+    // the monitor, so nothing slips through in between.
+    __attribute__((cleanup(sd_device_enumerator_unrefp))) sd_device_enumerator* enumerator = nullptr;
+    if (sd_device_enumerator_new(&enumerator) >= 0)
+    {
+        sd_device_enumerator_add_match_subsystem(enumerator, "hidraw", true);
+        for (
+            auto device = sd_device_enumerator_get_device_first(enumerator);
+            device;
+            device = sd_device_enumerator_get_device_next(enumerator)
+        )
+        {
+            const char* devname;
+            if (sd_device_get_devname(device, &devname) >= 0)
+                _open_device(devname);
+        }
+    }
+
+    auto read_device = [&](hidraw_device& dev) {
+        std::array<unsigned char, max_report_size> report;
+        while (true)
+        {
+            // hidraw returns exactly one report per read()
+            auto len = read(dev.fd, report.data(), report.size());
+            if (len < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN)
+                    _close_device(dev);
+                break;
+            }
+            // hidraw keeps no timestamps, so the report is stamped when it's read
+            _process_report(dev, std::span(report.data(), len), clock_usec(m_clock) - m_ref_usec);
+        }
+        _emit_reports(dev.sink, dev.path, dev.vid, dev.pid, dev.report_batch);
+        _emit_inputs(dev.sink, dev.path, dev.vid, dev.pid, dev.batch);
+        dev.report_batch.clear();
+        dev.batch.clear();
+    };
+
+    std::array<epoll_event, 64> events;
+    // Closed devices leave the map right away, so a node that comes back in
+    // the same batch is opened again. They are freed after the batch, because
+    // later events of it may still point at them.
+    std::vector<std::unique_ptr<hidraw_device>> removed;
+    clock_sampler sampler(m_clock, m_options.ClockSampleInterval);
+    while (!stop.stop_requested())
+    {
+        int count = epoll_wait(m_epoll_fd, events.data(), events.size(), sampler.timeout());
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            m_logger->error("Failed to wait for device events: {}", std::strerror(errno));
+            break;
+        }
+        if (auto sample = sampler.poll(m_ref_usec))
+            OnClockSample()(*sample);
+        for (auto& event: std::span(events.data(), count))
+        {
+            if (event.data.u64 == wakeup_tag)
+            {
+                eventfd_t value;
+                eventfd_read(m_wakeup_fd, &value);
+                continue;
+            }
+            if (event.data.u64 == monitor_tag)
+            {
+                _receive_hotplug(removed);
+                continue;
+            }
+            auto& dev = *static_cast<hidraw_device*>(event.data.ptr);
+            if (dev.fd >= 0)
+                read_device(dev);
+        }
+        removed.clear();
+    }
+}
+
+// udev only announces a node once its rules ran, so it has its final
+// permissions by the time it's opened
+void recorder_linux_hidraw::_receive_hotplug(std::vector<std::unique_ptr<hidraw_device>>& removed)
+{
+    while (true)
+    {
+        __attribute__((cleanup(sd_device_unrefp))) sd_device* device = nullptr;
+        int ret = sd_device_monitor_receive(m_monitor, &device);
+        if (ret < 0)
+            break;
+        // filtered out
+        if (ret == 0 || !device)
+            continue;
+        sd_device_action_t action;
+        const char* devname;
+        if (sd_device_get_action(device, &action) < 0 || sd_device_get_devname(device, &devname) < 0)
+            continue;
+        if (action != SD_DEVICE_ADD && action != SD_DEVICE_REMOVE)
+            continue;
+        std::string path(devname);
+        auto it = m_devices.find(path);
+        // a device that failed a read was closed, but is only replaced once
+        // its node is added again
+        if (it != m_devices.end() && (action == SD_DEVICE_REMOVE || it->second->fd < 0))
+        {
+            if (it->second->fd >= 0)
+                _close_device(*it->second);
+            removed.push_back(std::move(it->second));
+            m_devices.erase(it);
+        }
+        if (action == SD_DEVICE_ADD)
+            _open_device(path);
+    }
+}
+
+void recorder_linux_hidraw::Start(bool keyboard, bool mouse, bool gamepad)
+{
+    m_keyboard = keyboard;
+    m_mouse = mouse;
+    m_gamepad = gamepad;
+    m_ref_usec = clock_usec(m_clock);
+    OnClockSample()(sample_clocks(m_clock, m_ref_usec));
+
+    m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_epoll_fd < 0 || m_wakeup_fd < 0)
+        throw std::runtime_error("Failed to initialize the hidraw reader");
+    if (int ret = sd_device_monitor_new(&m_monitor); ret < 0)
+        throw std::runtime_error(std::format("Failed to create device monitor: {}", std::strerror(-ret)));
+    // filtered in the kernel, so we're only woken up for hidraw nodes
+    sd_device_monitor_filter_add_match_subsystem_devtype(m_monitor, "hidraw", nullptr);
+    sd_device_monitor_filter_update(m_monitor);
+
+    epoll_event wakeup_event{ .events = EPOLLIN, .data = { .u64 = wakeup_tag } };
+    epoll_event monitor_event{ .events = EPOLLIN, .data = { .u64 = monitor_tag } };
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_wakeup_fd, &wakeup_event);
+    epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, sd_device_monitor_get_fd(m_monitor), &monitor_event);
+
+    m_reader_thread = std::jthread([this](const std::stop_token& stop) {
+        std::stop_callback wake_on_stop(stop, [this]() {
+            eventfd_write(m_wakeup_fd, 1);
+        });
+        _run(stop);
+    });
+}
+
+void recorder_linux_hidraw::Stop()
+{
+    m_reader_thread.request_stop();
+    m_reader_thread.join();
+    for (auto& [path, dev]: m_devices)
+    {
+        if (dev->fd >= 0)
+            close(dev->fd);
+    }
+    m_devices.clear();
+    m_monitor = sd_device_monitor_unref(m_monitor);
+    close(m_wakeup_fd);
+    close(m_epoll_fd);
+    m_wakeup_fd = m_epoll_fd = -1;
+    OnClockSample()(sample_clocks(m_clock, m_ref_usec));
+}
+
+std::optional<CaptureClock> recorder_linux_hidraw::GetCaptureClock() const
+{
+    return m_options.Clock;
+}
+
+std::string recorder_linux_hidraw::GetDeviceName(std::string_view path) const
+{
+    return device_name_from_hidraw(path);
+}
+
+std::optional<std::string> recorder_linux_hidraw::GetUsbDeviceId(std::string_view id) const
+{
+    return find_usb_device_from_hidraw(id);
+}
+
+std::optional<UsbDeviceInfo> recorder_linux_hidraw::GetUsbDeviceInfo(std::string_view id) const
+{
+    return get_usb_device_info(id);
+}
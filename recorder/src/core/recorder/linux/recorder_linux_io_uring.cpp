@@ -0,0 +1,251 @@
+#include "impl.h"
+#include <spdlog/spdlog.h>
+
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <stdexcept>
+#include <stop_token>
+#include <thread>
+
+#include <fcntl.h>
+
+// Each buffer holds as many events as one read() in the epoll reader
+constexpr std::size_t buffer_events = 64;
+// Must be a power of 2
+constexpr unsigned buffer_count = 256;
+constexpr int buffer_group = 0;
+constexpr unsigned queue_depth = 256;
+
+// user_data of the entries that don't belong to a device. Device reads
+// carry (generation << 32 | fd), and fds never get this large.
+constexpr std::uint64_t wakeup_tag = ~0ULL;
+constexpr std::uint64_t cancel_tag = ~1ULL;
+
+// io_uring honours O_NONBLOCK and would complete with -EAGAIN instead of
+// waiting for data, so the fds it reads from have to block
+static bool set_blocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) == 0;
+}
+
+recorder_linux_io_uring::recorder_linux_io_uring(std::shared_ptr<spdlog::logger> logger, const RecorderOptions& options):
+    recorder_linux_libevdev(logger, options)
+{
+    // Busy polling reads the device fds directly, so the auto-probe falls back
+    // to the epoll reader for it
+    if (options.BusyPoll)
+        throw std::runtime_error("busy polling is only supported by the epoll reader");
+
+    // Check that the kernel can do what we need, so the auto-probe can fall
+    // back to the epoll reader if it can't
+    io_uring ring;
+    if (int ret = io_uring_queue_init(8, &ring, 0); ret < 0)
+        throw std::runtime_error(std::format("io_uring is not available: {}", std::strerror(-ret)));
+
+    // provided buffer rings are 5.19+, multishot reads are 6.7+
+    int ret = 0;
+    auto buf_ring = io_uring_setup_buf_ring(&ring, 1, buffer_group, 0, &ret);
+    if (!buf_ring)
+    {
+        io_uring_queue_exit(&ring);
+        throw std::runtime_error("io_uring doesn't support provided buffer rings");
+    }
+    io_uring_free_buf_ring(&ring, buf_ring, 1, buffer_group);
+
+    if (auto probe = io_uring_get_probe_ring(&ring))
+    {
+        m_multishot = io_uring_opcode_supported(probe, IORING_OP_READ_MULTISHOT);
+        io_uring_free_probe(probe);
+    }
+    io_uring_queue_exit(&ring);
+    m_logger->debug("io_uring multishot reads are {}", m_multishot ? "supported" : "not supported");
+}
+
+recorder_linux_io_uring::uring_shard::~uring_shard()
+{
+    if (!ring_initialized)
+        return;
+    if (buf_ring)
+        io_uring_free_buf_ring(&ring, buf_ring, buffer_count, buffer_group);
+    io_uring_queue_exit(&ring);
+}
+
+io_uring_sqe* recorder_linux_io_uring::_get_sqe(uring_shard& shard)
+{
+    auto sqe = io_uring_get_sqe(&shard.ring);
+    if (!sqe)
+    {
+        // the submission queue is full, flush it to make room
+        io_uring_submit(&shard.ring);
+        sqe = io_uring_get_sqe(&shard.ring);
+    }
+    return sqe;
+}
+
+void recorder_linux_io_uring::_arm_read(uring_shard& shard, int fd)
+{
+    auto sqe = _get_sqe(shard);
+    if (m_multishot)
+    {
+        io_uring_prep_read_multishot(sqe, fd, 0, 0, buffer_group);
+    }
+    else
+    {
+        io_uring_prep_read(sqe, fd, nullptr, buffer_events * sizeof(input_event), 0);
+        sqe->flags |= IOSQE_BUFFER_SELECT;
+        sqe->buf_group = buffer_group;
+    }
+    std::uint64_t generation = shard.slots[fd].generation;
+    io_uring_sqe_set_data64(sqe, generation << 32 | static_cast<std::uint32_t>(fd));
+}
+
+void recorder_linux_io_uring::_arm_wakeup(uring_shard& shard)
+{
+    auto sqe = _get_sqe(shard);
+    io_uring_prep_read(sqe, shard.wakeup_fd, &shard.wakeup_value, sizeof(shard.wakeup_value), 0);
+    io_uring_sqe_set_data64(sqe, wakeup_tag);
+}
+
+void recorder_linux_io_uring::_recycle_buffer(uring_shard& shard, std::uint16_t id)
+{
+    io_uring_buf_ring_add(
+        shard.buf_ring,
+        shard.buffers.data() + id * buffer_events, buffer_events * sizeof(input_event),
+        id, io_uring_buf_ring_mask(buffer_count), 0
+    );
+    io_uring_buf_ring_advance(shard.buf_ring, 1);
+}
+
+std::unique_ptr<recorder_linux_libevdev::reader_shard> recorder_linux_io_uring::_create_shard()
+{
+    auto shard = std::make_unique<uring_shard>();
+    if (!set_blocking(shard->wakeup_fd))
+        throw std::runtime_error("Failed to set up wakeup event");
+
+    if (int ret = io_uring_queue_init(queue_depth, &shard->ring, 0); ret < 0)
+        throw std::runtime_error(std::format("Failed to create io_uring: {}", std::strerror(-ret)));
+    shard->ring_initialized = true;
+
+    int ret = 0;
+    shard->buf_ring = io_uring_setup_buf_ring(&shard->ring, buffer_count, buffer_group, 0, &ret);
+    if (!shard->buf_ring)
+        throw std::runtime_error(std::format("Failed to register io_uring buffers: {}", std::strerror(-ret)));
+    shard->buffers.resize(buffer_count * buffer_events);
+    for (std::uint16_t i = 0; i < buffer_count; ++i)
+    {
+        io_uring_buf_ring_add(
+            shard->buf_ring,
+            shard->buffers.data() + i * buffer_events, buffer_events * sizeof(input_event),
+            i, io_uring_buf_ring_mask(buffer_count), i
+        );
+    }
+    io_uring_buf_ring_advance(shard->buf_ring, buffer_count);
+    return shard;
+}
+
+bool recorder_linux_io_uring::_watch(reader_shard& shard, internal_device& dev)
+{
+    auto& uring = static_cast<uring_shard&>(shard);
+    int fd = libevdev_get_fd(dev.event_device);
+    if (!set_blocking(fd))
+        return false;
+    if (static_cast<std::size_t>(fd) >= uring.slots.size())
+        uring.slots.resize(fd + 1);
+    auto& slot = uring.slots[fd];
+    slot.device = &dev;
+    ++slot.generation;
+    // submitted together with everything else on the next loop iteration
+    _arm_read(uring, fd);
+    return true;
+}
+
+void recorder_linux_io_uring::_unwatch(reader_shard& shard, internal_device& dev)
+{
+    auto& uring = static_cast<uring_shard&>(shard);
+    int fd = libevdev_get_fd(dev.event_device);
+    auto& slot = uring.slots[fd];
+    slot.device = nullptr;
+    ++slot.generation;
+    auto sqe = _get_sqe(uring);
+    io_uring_prep_cancel_fd(sqe, fd, 0);
+    io_uring_sqe_set_data64(sqe, cancel_tag);
+    // the cancel looks up the file by fd, it has to reach the kernel before the fd is closed
+    io_uring_submit(&uring.ring);
+}
+
+void recorder_linux_io_uring::_handle_read(uring_shard& shard, io_uring_cqe* cqe)
+{
+    int fd = static_cast<std::uint32_t>(cqe->user_data);
+    std::uint32_t generation = cqe->user_data >> 32;
+    bool has_buffer = cqe->flags & IORING_CQE_F_BUFFER;
+    std::uint16_t buffer_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+    auto& slot = shard.slots[fd];
+    // a completion for a device that has been unwatched since
+    if (slot.generation != generation || !slot.device)
+    {
+        if (has_buffer)
+            _recycle_buffer(shard, buffer_id);
+        return;
+    }
+    auto& dev = *slot.device;
+    if (cqe->res > 0 && has_buffer)
+    {
+        std::size_t count = cqe->res / sizeof(input_event);
+        _process_events(dev, std::span(shard.buffers.data() + buffer_id * buffer_events, count));
+        _deliver(dev);
+    }
+    // a buffer can come with an empty read too, it goes back in every case
+    if (has_buffer)
+        _recycle_buffer(shard, buffer_id);
+    if (cqe->res <= 0 && cqe->res != -ENOBUFS && cqe->res != -EINTR && cqe->res != -EAGAIN)
+    {
+        // the device is gone, don't re-arm it. It is closed once its removal comes in.
+        slot.device = nullptr;
+        ++slot.generation;
+        return;
+    }
+    // single reads, and multishot reads that ran out of buffers, have to be re-armed
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        _arm_read(shard, fd);
+}
+
+void recorder_linux_io_uring::_run_shard(reader_shard& shard, const std::stop_token& stop)
+{
+    auto& uring = static_cast<uring_shard&>(shard);
+    _arm_wakeup(uring);
+    _sync_devices(shard);
+    while (!stop.stop_requested())
+    {
+        // submit the re-armed reads and block until at least one completes
+        int ret = io_uring_submit_and_wait(&uring.ring, 1);
+        if (ret < 0 && ret != -EINTR)
+        {
+            m_logger->error("Failed to wait for device events: {}", std::strerror(-ret));
+            break;
+        }
+
+        bool hotplug = false;
+        unsigned head;
+        unsigned count = 0;
+        io_uring_cqe* cqe;
+        io_uring_for_each_cqe(&uring.ring, head, cqe)
+        {
+            ++count;
+            if (cqe->user_data == cancel_tag)
+                continue;
+            if (cqe->user_data == wakeup_tag)
+            {
+                hotplug = true;
+                _arm_wakeup(uring);
+                continue;
+            }
+            _handle_read(uring, cqe);
+        }
+        io_uring_cq_advance(&uring.ring, count);
+        if (hotplug)
+            _sync_devices(shard);
+    }
+}
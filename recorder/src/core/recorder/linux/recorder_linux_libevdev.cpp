@@ -1,26 +1,51 @@
 #include "impl.h"
+#include "clock.h"
 #include "device_name.h"
-#include <boost/container/static_vector.hpp>
-#include <boost/iterator/transform_iterator.hpp>
+#include "realtime.h"
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <array>
+#include <cstring>
 #include <format>
+#include <span>
+#include <stop_token>
 #include <thread>
 #include <string>
 #include <string_view>
 #include <utility>
+#include <vector>
 
 #include <fcntl.h>
-#include <glob.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
-#include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <systemd/sd-device.h>
 #include "evdev_to_keycode.h"
 
-using namespace boost::container;
 using namespace boost::unordered;
 using namespace std::literals;
 
+// Empty rounds a busy polling reader spins through before it starts backing off
+constexpr unsigned busy_poll_spin_rounds = 1000;
+// Microseconds over which the CPU share of a busy polling reader is enforced
+constexpr std::uint64_t cpu_share_window = 10000;
+
+// Tells the CPU we're spinning, which saves power and frees up the sibling
+// hyperthread
+static void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
 #ifndef input_event_sec
 #define input_event_sec time.tv_sec
 #endif
@@ -42,10 +67,20 @@ bool is_mouse(libevdev* device)
 
 bool is_gamepad(libevdev* device)
 {
-    // TODO: get a gamepad and implement this
-    return false;
+    return libevdev_has_event_code(device, EV_KEY, BTN_GAMEPAD) ||
+        libevdev_has_event_code(device, EV_KEY, BTN_JOYSTICK);
 }
 
+// Axes as the kernel's gamepad drivers report them, see the Linux gamepad spec
+constexpr std::array<std::pair<std::uint16_t, GamepadAxis>, 6> evdev_gamepad_axes = {{
+    { ABS_X, GamepadAxis::LeftX },
+    { ABS_Y, GamepadAxis::LeftY },
+    { ABS_RX, GamepadAxis::RightX },
+    { ABS_RY, GamepadAxis::RightY },
+    { ABS_Z, GamepadAxis::LeftTrigger },
+    { ABS_RZ, GamepadAxis::RightTrigger },
+}};
+
 libevdev* evdev_open(const char* path)
 {
     int fd = open(path, O_RDONLY | O_NONBLOCK);
@@ -77,212 +112,888 @@ void evdev_close_p(libevdev** ptr)
     evdev_close(*ptr);
 }
 
-void recorder_linux_libevdev::_init_scan_devices()
+// libevdev only filters disabled events after they've been read. Mirror what
+// it has enabled into the kernel's per-fd event mask, so disabled events are
+// never queued and don't wake up the reader. Needs Linux 4.4+.
+bool evdev_set_kernel_mask(libevdev* device)
 {
-    auto default_construct = [](std::string_view path) {
-        return std::make_pair(path, internal_device{
-            .syspath = std::string(path)
-        });
+    constexpr std::size_t long_bits = sizeof(unsigned long) * 8;
+    int fd = libevdev_get_fd(device);
+    auto set_mask = [&](unsigned int type, unsigned int count, auto&& enabled) {
+        std::vector<unsigned long> bits((count + long_bits - 1) / long_bits);
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            if (enabled(i))
+                bits[i / long_bits] |= 1UL << (i % long_bits);
+        }
+        input_mask mask{
+            .type = type,
+            .codes_size = static_cast<std::uint32_t>(bits.size() * sizeof(unsigned long)),
+            .codes_ptr = reinterpret_cast<std::uintptr_t>(bits.data())
+        };
+        return ioctl(fd, EVIOCSMASK, &mask) == 0;
     };
-    glob_t glob_result;
-    if (glob("/dev/input/by-id/*event*", 0, nullptr, &glob_result) == 0)
-    {
-        auto gl_pathc = glob_result.gl_pathc;
-        auto gl_pathv = glob_result.gl_pathv;
-        m_evdev_devices.insert(
-            boost::make_transform_iterator(gl_pathv, default_construct),
-            boost::make_transform_iterator(gl_pathv + gl_pathc, default_construct)
+
+    // the EV_SYN mask selects the event types, EV_SYN itself is never filtered
+    if (!set_mask(EV_SYN, EV_CNT, [&](unsigned int type) { return libevdev_has_event_type(device, type); }))
+        return false;
+    for (unsigned int type = EV_SYN + 1; type < EV_CNT; ++type)
+    {
+        int max = libevdev_event_type_get_max(type);
+        if (max < 0 || !libevdev_has_event_type(device, type))
+            continue;
+        auto has_code = [&](unsigned int code) { return libevdev_has_event_code(device, type, code); };
+        if (!set_mask(type, max + 1, has_code))
+            return false;
+    }
+    return true;
+}
+
+// Devices are known by their by-id link when they have one, so the IDs stay
+// the same across reboots. Devices without one (PS/2, Bluetooth, ...) fall
+// back to their event node.
+static std::optional<std::string> evdev_device_id(sd_device* device)
+{
+    const char *sysname, *devname;
+    if (sd_device_get_sysname(device, &sysname) != 0 || !std::string_view(sysname).starts_with("event"))
+        return {};
+    if (sd_device_get_devname(device, &devname) != 0)
+        return {};
+    for (auto link = sd_device_get_devlink_first(device); link; link = sd_device_get_devlink_next(device))
+    {
+        if (std::string_view(link).starts_with("/dev/input/by-id/"))
+            return link;
+    }
+    return devname;
+}
+
+// Everything that is slow about a new device, opening it and reading its
+// capabilities and state, is done here on the setup thread. Readers only
+// ever see devices that are ready to be watched.
+std::unique_ptr<internal_device> recorder_linux_libevdev::_open_device(const std::string& path)
+{
+    auto dev = std::make_unique<internal_device>(internal_device{
+        .syspath = path,
+        .shard = _shard_of(path)
+    });
+    __attribute__((cleanup(evdev_close_p))) libevdev* event_device = evdev_open(path.data());
+    if (!event_device)
+    {
+        m_logger->warn(
+            "Failed to open device {}. Are you running as root/in the 'input' user group?",
+            path
         );
+        return nullptr;
     }
-    m_device_scan_thread = std::jthread([&](const std::stop_token& stop) {
-        int notify_fd = inotify_init1(IN_NONBLOCK);
-        inotify_add_watch(notify_fd, "/dev/input/by-id", IN_CREATE | IN_DELETE);
-        pollfd poll_struct{
-            .fd = notify_fd,
-            .events = POLLIN
-        };
+
+    // ignore virtual devices
+    if (!libevdev_get_phys(event_device))
+        return nullptr;
+
+    // remove devices that don't send keys
+    if (!libevdev_has_event_type(event_device, EV_KEY))
+        return nullptr;
+
+    // disable all events, and only enable the one we need
+    if (m_mouse && m_options.Motion != MouseMotion::OFF)
+    {
+        for (int i = 0; i <= REL_MAX; ++i)
+        {
+            if (i != REL_X && i != REL_Y)
+                libevdev_disable_event_code(event_device, EV_REL, i);
+        }
+    }
+    else
+    {
+        libevdev_disable_event_type(event_device, EV_REL);
+    }
+    if (m_gamepad && is_gamepad(event_device))
+    {
+        // only the sticks, triggers and the d-pad hat
+        for (int i = 0; i <= ABS_MAX; ++i)
+        {
+            bool axis = std::any_of(evdev_gamepad_axes.begin(), evdev_gamepad_axes.end(),
+                [&](auto& entry) { return entry.first == i; });
+            if (!axis && i != ABS_HAT0X && i != ABS_HAT0Y)
+                libevdev_disable_event_code(event_device, EV_ABS, i);
+        }
+        for (auto [code, axis]: evdev_gamepad_axes)
+        {
+            auto& range = dev->axis_range[static_cast<std::size_t>(axis)];
+            range.first = libevdev_get_abs_minimum(event_device, code);
+            range.second = libevdev_get_abs_maximum(event_device, code);
+        }
+    }
+    else
+    {
+        libevdev_disable_event_type(event_device, EV_ABS);
+    }
+    // keep MSC_TIMESTAMP, it carries the device's own clock
+    for (int i = 0; i <= MSC_MAX; ++i)
+    {
+        if (i != MSC_TIMESTAMP)
+            libevdev_disable_event_code(event_device, EV_MSC, i);
+    }
+    libevdev_disable_event_type(event_device, EV_SW);
+    libevdev_disable_event_type(event_device, EV_LED);
+    libevdev_disable_event_type(event_device, EV_SND);
+    libevdev_disable_event_type(event_device, EV_REP);
+    libevdev_disable_event_type(event_device, EV_FF);
+    libevdev_disable_event_type(event_device, EV_PWR);
+    libevdev_disable_event_type(event_device, EV_FF_STATUS);
+    if (!m_keyboard)
+    {
+        for (int i = 0; i < 256; ++i)
+            libevdev_disable_event_code(event_device, EV_KEY, i);
+    }
+    if (!m_mouse)
+    {
+        for (int i = BTN_LEFT; i <= BTN_TASK; ++i)
+            libevdev_disable_event_code(event_device, EV_KEY, i);
+    }
+    if (!m_gamepad)
+    {
+        for (int i = BTN_JOYSTICK; i <= BTN_THUMBR; ++i)
+            libevdev_disable_event_code(event_device, EV_KEY, i);
+        for (int i = BTN_DPAD_UP; i <= BTN_DPAD_RIGHT; ++i)
+            libevdev_disable_event_code(event_device, EV_KEY, i);
+    }
+    libevdev_set_clock_id(event_device, m_clock);
+    if (!evdev_set_kernel_mask(event_device))
+        m_logger->debug("Kernel event masks are not supported for device {}, filtering in userspace", path);
+
+    dev->event_device = event_device;
+    dev->vid = libevdev_get_id_vendor(event_device);
+    dev->pid = libevdev_get_id_product(event_device);
+    for (int i = 0; i < KEY_CNT; ++i)
+        dev->key_state[i] = libevdev_get_event_value(event_device, EV_KEY, i);
+    event_device = nullptr;
+    return dev;
+}
+
+void recorder_linux_libevdev::_add_device(const std::string& id)
+{
+    // the setup thread is the only one adding and removing devices, only
+    // the erase by the reader can happen in between
+    bool present = false;
+    m_evdev_devices.cvisit(id, [&](const EvdevDeviceMap::value_type& entry) {
+        present = !entry.second->remove;
+    });
+    if (present)
+        return;
+    auto dev = _open_device(id);
+    if (!dev)
+        return;
+    unsigned shard = dev->shard;
+    // Plugged back in before the reader closed it. The old device is handed
+    // to the reader separately, so it's closed without taking the new one along.
+    std::unique_ptr<internal_device> stale;
+    m_evdev_devices.try_emplace_or_visit(id, std::move(dev), [&](EvdevDeviceMap::value_type& entry) {
+        stale = std::exchange(entry.second, std::move(dev));
+    });
+    if (stale)
+    {
+        auto& reader = *m_shards[shard];
+        std::lock_guard lock(reader.retired_mutex);
+        reader.retired.push_back(std::move(stale));
+    }
+    _wake(shard);
+}
+
+void recorder_linux_libevdev::_remove_device(const std::string& id)
+{
+    bool found = m_evdev_devices.visit(id, [](EvdevDeviceMap::value_type& dev) {
+        dev.second->remove = true;
+    });
+    if (found)
+        _wake(_shard_of(id));
+}
+
+void recorder_linux_libevdev::_init_setup_thread()
+{
+    if (int ret = sd_device_monitor_new(&m_monitor); ret < 0)
+        throw std::runtime_error(std::format("Failed to create device monitor: {}", std::strerror(-ret)));
+    // filtered in the kernel, so we're only woken up for input devices
+    sd_device_monitor_filter_add_match_subsystem_devtype(m_monitor, "input", nullptr);
+    sd_device_monitor_filter_update(m_monitor);
+    m_setup_wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_setup_wakeup_fd < 0)
+        throw std::runtime_error("Failed to create wakeup event");
+
+    m_setup_thread = std::jthread([this](const std::stop_token& stop) {
+        std::stop_callback wake_on_stop(stop, [this]() {
+            eventfd_write(m_setup_wakeup_fd, 1);
+        });
+        // it opens hotplugged devices and takes the clock samples, both of
+        // which shouldn't be held up by the rest of the system
+        _init_realtime_thread();
+
+        // Devices that are already there. Anything added from now on is
+        // queued on the monitor, so nothing slips through in between.
+        __attribute__((cleanup(sd_device_enumerator_unrefp))) sd_device_enumerator* enumerator = nullptr;
+        if (sd_device_enumerator_new(&enumerator) >= 0)
+        {
+            sd_device_enumerator_add_match_subsystem(enumerator, "input", true);
+            sd_device_enumerator_add_match_sysname(enumerator, "event*");
+            for (
+                auto device = sd_device_enumerator_get_device_first(enumerator);
+                device;
+                device = sd_device_enumerator_get_device_next(enumerator)
+            )
+            {
+                if (auto id = evdev_device_id(device))
+                    _add_device(*id);
+            }
+        }
+
+        // the clock samples are taken here too, so the readers don't have to
+        clock_sampler sampler(m_clock, m_options.ClockSampleInterval);
+        std::array<pollfd, 2> poll_fds{{
+            { .fd = sd_device_monitor_get_fd(m_monitor), .events = POLLIN },
+            { .fd = m_setup_wakeup_fd, .events = POLLIN }
+        }};
         while (!stop.stop_requested())
         {
-            int result = poll(&poll_struct, 1, 100);
-            if (result == 0)
-                continue;
-            constexpr int notify_event_count = 100;
-            std::array<inotify_event, notify_event_count> notify_events;
-            while (true)
+            int count = poll(poll_fds.data(), poll_fds.size(), sampler.timeout());
+            if (count < 0)
             {
-                auto len = read(
-                    notify_fd,
-                    reinterpret_cast<char*>(notify_events.data()),
-                    sizeof(inotify_event) * notify_events.size()
-                );
-                if (len < 0)
-                {
-                    if (errno != EAGAIN)
-                        throw std::runtime_error("An error occurred when checking for devices");
-                    break;
-                }
-                static_vector<std::string, notify_event_count> added, removed;                
-                for (auto i = notify_events.begin(); i != notify_events.begin() + len / sizeof(inotify_event); i++)
-                {
-                    std::string_view path(i->name);
-                    if (path.find("event") == std::string::npos)
-                        continue;
-                    if (i->mask & IN_CREATE)
-                    {
-                        added.emplace_back(
-                            std::format("/dev/input/by-id/{}", path)
-                        );
-                    }
-                    else if (i->mask & IN_DELETE)
-                    {
-                        removed.emplace_back(
-                            std::format("/dev/input/by-id/{}", path)
-                        );
-                    }
-                }
-                m_evdev_devices.insert(
-                    boost::make_transform_iterator(added.begin(), default_construct),
-                    boost::make_transform_iterator(added.end(), default_construct)
-                );
-                m_evdev_devices.visit(removed.begin(), removed.end(),
-                    [](EvdevDeviceMap::value_type& dev) {
-                        dev.second.remove = true;
-                    }
-                );
+                if (errno == EINTR)
+                    continue;
+                m_logger->error("Failed to wait for new devices: {}", std::strerror(errno));
+                break;
             }
+            // the reference is only read once capturing is seen, a warm Start
+            // in between would otherwise get a sample from the old reference
+            bool capturing = m_capturing.load(std::memory_order_acquire);
+            if (auto sample = sampler.poll(m_ref_usec); sample && capturing)
+                OnClockSample()(*sample);
+            if (count > 0 && poll_fds[0].revents & POLLIN)
+                _receive_hotplug();
         }
-        close(notify_fd);
     });
 }
 
-void recorder_linux_libevdev::_init_poll(bool keyboard, bool mouse, bool gamepad)
+void recorder_linux_libevdev::_receive_hotplug()
 {
-    m_poll_thread = std::jthread([=, this](const std::stop_token& stop) {
-        timespec ref;
-        clock_gettime(CLOCK_MONOTONIC, &ref);
-        std::uint64_t ref_usec = ref.tv_sec * 1000000 + ref.tv_nsec / 1000;
-        std::vector<internal_device*> devices;
-        std::vector<pollfd> pollfds;
-        while (!stop.stop_requested())
+    while (true)
+    {
+        __attribute__((cleanup(sd_device_unrefp))) sd_device* device = nullptr;
+        int ret = sd_device_monitor_receive(m_monitor, &device);
+        if (ret < 0)
+            break;
+        // filtered out
+        if (ret == 0 || !device)
+            continue;
+        sd_device_action_t action;
+        auto id = evdev_device_id(device);
+        if (!id || sd_device_get_action(device, &action) < 0)
+            continue;
+        if (action == SD_DEVICE_ADD)
+            _add_device(*id);
+        else if (action == SD_DEVICE_REMOVE)
+            _remove_device(*id);
+    }
+}
+
+unsigned recorder_linux_libevdev::_shard_of(std::string_view path) const
+{
+    // the shards may not exist yet when the first devices are found
+    unsigned count = std::max(m_options.ReaderThreads, 1u);
+    if (auto it = m_options.ReaderThreadMap.find(std::string(path)); it != m_options.ReaderThreadMap.end())
+        return it->second % count;
+    return std::hash<std::string_view>{}(path) % count;
+}
+
+void recorder_linux_libevdev::_wake(unsigned shard)
+{
+    eventfd_write(m_shards[shard]->wakeup_fd, 1);
+}
+
+// Only runs on hotplug, the hot loop never walks the device map
+void recorder_linux_libevdev::_sync_devices(reader_shard& shard)
+{
+    if (auto generation = m_pause_generation.load(std::memory_order_acquire); shard.pause_generation != generation)
+    {
+        shard.pause_generation = generation;
+        m_evdev_devices.visit_all([&](EvdevDeviceMap::value_type& val) {
+            auto& dev = *val.second;
+            if (dev.shard != shard.index)
+                return;
+            _flush_motion(dev);
+            _deliver(dev);
+            // frames count from 1 again in the next recording
+            dev.frame = 0;
+        });
+        m_pause_done->count_down();
+    }
+    std::vector<std::unique_ptr<internal_device>> retired;
+    {
+        std::lock_guard lock(shard.retired_mutex);
+        retired.swap(shard.retired);
+    }
+    for (auto& dev: retired)
+        _close_device(shard, *dev);
+    m_evdev_devices.erase_if([&](EvdevDeviceMap::value_type& val) {
+        auto& path = val.first;
+        auto& dev = *val.second;
+        if (dev.shard != shard.index)
+            return false;
+        if (dev.remove)
         {
-            devices.clear();
-            pollfds.clear();
-            // I'm not sure if this is safe (modify elements inside erase_if). Let's see
-            m_evdev_devices.erase_if([&](EvdevDeviceMap::value_type& val) {
-                auto& [path, dev] = val;
-                if (dev.remove)
-                {
-                    m_logger->debug("Device {} removed", path);
-                    evdev_close(dev.event_device);
-                    return true;
-                }
-                // New device, try to open it
-                if (!dev.event_device)
+            _close_device(shard, dev);
+            return true;
+        }
+        if (dev.watched)
+            return false;
+
+        // New device, the setup thread has opened it already
+        if (!_watch(shard, dev))
+        {
+            m_logger->warn("Failed to watch device {}", path);
+            evdev_close(dev.event_device);
+            return true;
+        }
+        dev.watched = true;
+        m_logger->debug("Watching device {} on reader {}", path, shard.index);
+        return false;
+    });
+}
+
+void recorder_linux_libevdev::_close_device(reader_shard& shard, internal_device& dev)
+{
+    m_logger->debug("Device {} removed", dev.syspath);
+    _flush_motion(dev);
+    _deliver(dev);
+    if (dev.watched)
+        _unwatch(shard, dev);
+    evdev_close(dev.event_device);
+}
+
+std::optional<std::uint64_t> recorder_linux_libevdev::_receive_timestamp(const internal_device& dev) const
+{
+    std::uint64_t ref_usec = m_ref_usec;
+    if (!dev.receive_timestamp || *dev.receive_timestamp < ref_usec)
+        return std::nullopt;
+    return *dev.receive_timestamp - ref_usec;
+}
+
+void recorder_linux_libevdev::_emit(
+    internal_device& dev, std::uint64_t timestamp, std::uint16_t code, bool pressed,
+    std::optional<std::uint64_t> device_timestamp
+)
+{
+    if (!m_capturing.load(std::memory_order_acquire))
+        return;
+    // read in warm standby before Start took the reference, but only handled after
+    std::uint64_t ref_usec = m_ref_usec;
+    if (timestamp < ref_usec)
+        return;
+    dev.batch.push_back(Input{
+        .Timestamp = timestamp - ref_usec,
+        .Pressed = pressed,
+        .Code = evdev_to_keycode(code),
+        .Frame = dev.frame,
+        .DeviceTimestamp = device_timestamp,
+        .ReceiveTimestamp = _receive_timestamp(dev)
+    });
+}
+
+void recorder_linux_libevdev::_deliver(internal_device& dev)
+{
+    _emit_axes(dev.sink, dev.syspath, dev.vid, dev.pid, dev.axis_batch);
+    _emit_inputs(dev.sink, dev.syspath, dev.vid, dev.pid, dev.batch);
+    dev.axis_batch.clear();
+    dev.batch.clear();
+}
+
+void recorder_linux_libevdev::_flush_motion(internal_device& dev)
+{
+    if (!dev.motion)
+        return;
+    auto& motion = *dev.motion;
+    std::uint64_t ref_usec = m_ref_usec;
+    if (motion.timestamp < ref_usec)
+    {
+        dev.motion.reset();
+        return;
+    }
+    dev.batch.push_back(Input{
+        .Timestamp = motion.timestamp - ref_usec,
+        .Pressed = false,
+        .Code = Keycode::None,
+        .Frame = motion.frame,
+        .DeviceTimestamp = motion.device_timestamp,
+        .ReceiveTimestamp = motion.receive_timestamp,
+        .Kind = InputKind::MOTION,
+        .DX = motion.dx,
+        .DY = motion.dy,
+        .Reports = motion.reports
+    });
+    dev.motion.reset();
+}
+
+// Coalesced motion is flushed by the first report that falls outside its
+// interval, so a window only ever holds reports from that interval
+void recorder_linux_libevdev::_emit_motion(internal_device& dev, std::uint64_t timestamp)
+{
+    // what's left of the recording is flushed, and nothing new is started
+    if (!m_capturing.load(std::memory_order_acquire))
+    {
+        _flush_motion(dev);
+        return;
+    }
+    // windows only ever start within the recording
+    if (timestamp < m_ref_usec)
+        return;
+    if (dev.motion && timestamp - dev.motion->start >= m_options.MotionInterval)
+        _flush_motion(dev);
+    if (!dev.motion)
+    {
+        dev.motion = internal_device::pending_motion{
+            .start = timestamp,
+            .dx = 0,
+            .dy = 0,
+            .reports = 0
+        };
+    }
+    auto& motion = *dev.motion;
+    motion.timestamp = timestamp;
+    motion.frame = dev.frame;
+    motion.device_timestamp = dev.frame_device_timestamp;
+    motion.receive_timestamp = _receive_timestamp(dev);
+    motion.dx += dev.frame_dx;
+    motion.dy += dev.frame_dy;
+    ++motion.reports;
+    if (m_options.Motion == MouseMotion::RAW)
+        _flush_motion(dev);
+}
+
+void recorder_linux_libevdev::_emit_axis(
+    internal_device& dev, std::uint64_t timestamp, GamepadAxis axis, std::int32_t value
+)
+{
+    if (!m_capturing.load(std::memory_order_acquire))
+        return;
+    std::uint64_t ref_usec = m_ref_usec;
+    if (timestamp < ref_usec)
+        return;
+    auto [min, max] = dev.axis_range[static_cast<std::size_t>(axis)];
+    std::int64_t scaled = max > min
+        ? (static_cast<std::int64_t>(value) - min) * 65535 / (static_cast<std::int64_t>(max) - min) - 32768
+        : 0;
+    dev.axis_batch.push_back(AxisSample{
+        .Timestamp = timestamp - ref_usec,
+        .Frame = dev.frame,
+        .Axis = axis,
+        .Value = static_cast<std::int16_t>(std::clamp<std::int64_t>(scaled, -32768, 32767))
+    });
+}
+
+// After SYN_DROPPED the kernel buffer overflowed and we don't know what
+// happened in between. Ask the kernel for the current key state and
+// synthesize the transitions we missed, like libevdev does. The gap is
+// reported either way, so the recording shows that inputs were lost.
+void recorder_linux_libevdev::_resync(internal_device& dev, std::uint64_t timestamp)
+{
+    bool capturing = m_capturing.load(std::memory_order_acquire);
+    std::uint64_t ref_usec = m_ref_usec;
+    // a gap that started in warm standby is only reported from the start of the recording
+    InputGap gap{
+        .Start = std::max(dev.drop_timestamp, ref_usec) - ref_usec,
+        .End = std::max(timestamp, ref_usec) - ref_usec,
+        .Synthesized = 0,
+        .Resynced = false
+    };
+    constexpr std::size_t long_bits = sizeof(unsigned long) * 8;
+    std::array<unsigned long, (KEY_CNT + long_bits - 1) / long_bits> bits{};
+    int fd = libevdev_get_fd(dev.event_device);
+    if (ioctl(fd, EVIOCGKEY(sizeof(bits)), bits.data()) < 0)
+    {
+        m_logger->warn("Failed to resync device {}", dev.syspath);
+        if (capturing)
+            OnGap()(dev.syspath, gap);
+        return;
+    }
+    gap.Resynced = true;
+    for (std::uint16_t code = 0; code < KEY_CNT; ++code)
+    {
+        bool pressed = bits[code / long_bits] >> (code % long_bits) & 1;
+        if (pressed == dev.key_state[code] || !libevdev_has_event_code(dev.event_device, EV_KEY, code))
+            continue;
+        dev.key_state[code] = pressed;
+        _emit(dev, timestamp, code, pressed);
+        ++gap.Synthesized;
+    }
+    if (capturing)
+        OnGap()(dev.syspath, gap);
+}
+
+void recorder_linux_libevdev::_process_events(internal_device& dev, std::span<const input_event> events)
+{
+    for (auto& ev: events)
+    {
+        std::uint64_t timestamp = ev.input_event_sec * 1000000ULL + ev.input_event_usec;
+        if (ev.type == EV_SYN && ev.code == SYN_DROPPED)
+        {
+            m_logger->debug("Device {} dropped events, resyncing", dev.syspath);
+            // another overflow before we caught up extends the same gap
+            if (!dev.dropped)
+                dev.drop_timestamp = timestamp;
+            dev.dropped = true;
+            // the frame we were in the middle of is incomplete
+            dev.frame_keys.clear();
+            dev.frame_device_timestamp.reset();
+            dev.frame_dx = dev.frame_dy = 0;
+            dev.frame_motion = false;
+            dev.frame_axes.clear();
+            continue;
+        }
+        // everything up to the next SYN_REPORT is incomplete and must be discarded
+        if (dev.dropped)
+        {
+            if (ev.type == EV_SYN && ev.code == SYN_REPORT)
+            {
+                dev.dropped = false;
+                // the synthesized inputs make up the frame of this SYN_REPORT
+                ++dev.frame;
+                _flush_motion(dev);
+                _resync(dev, timestamp);
+            }
+            continue;
+        }
+        if (ev.type == EV_SYN && ev.code == SYN_REPORT)
+        {
+            ++dev.frame;
+            // keep the inputs of a device in timestamp order
+            if (!dev.frame_keys.empty())
+                _flush_motion(dev);
+            for (auto& key: dev.frame_keys)
+            {
+                dev.key_state[key.code] = key.pressed;
+                _emit(dev, key.timestamp, key.code, key.pressed, dev.frame_device_timestamp);
+            }
+            if (dev.frame_motion)
+                _emit_motion(dev, timestamp);
+            for (auto [axis, value]: dev.frame_axes)
+                _emit_axis(dev, timestamp, axis, value);
+            dev.frame_axes.clear();
+            dev.frame_keys.clear();
+            dev.frame_device_timestamp.reset();
+            dev.frame_dx = dev.frame_dy = 0;
+            dev.frame_motion = false;
+            continue;
+        }
+        if (ev.type == EV_MSC && ev.code == MSC_TIMESTAMP)
+        {
+            auto raw = static_cast<std::uint32_t>(ev.value);
+            // unsigned subtraction takes care of the wraparound
+            dev.device_clock = dev.device_clock
+                ? *dev.device_clock + static_cast<std::uint32_t>(raw - dev.device_clock_raw)
+                : raw;
+            dev.device_clock_raw = raw;
+            dev.frame_device_timestamp = dev.device_clock;
+            continue;
+        }
+        if (ev.type == EV_REL)
+        {
+            // filtered in _open_device unless motion is recorded
+            if (ev.code == REL_X)
+                dev.frame_dx += ev.value;
+            else if (ev.code == REL_Y)
+                dev.frame_dy += ev.value;
+            else
+                continue;
+            dev.frame_motion = true;
+            continue;
+        }
+        if (ev.type == EV_ABS)
+        {
+            // the hat is reported as an axis, turn it into d-pad buttons
+            auto set_hat = [&](std::uint16_t negative, std::uint16_t positive) {
+                for (auto [code, pressed]: { std::pair{ negative, ev.value < 0 }, std::pair{ positive, ev.value > 0 } })
                 {
-                    __attribute__((cleanup(evdev_close_p))) libevdev* event_device = evdev_open(path.data());
-                    if (!event_device)
-                    {
-                        m_logger->warn(
-                            "Failed to open device {}. Are you running as root/in the 'input' user group?",
-                            path
-                        );
-                        return true;
-                    }
-
-                    // ignore virtual devices
-                    if (!libevdev_get_phys(event_device))
-                        return true;
-
-                    // remove devices that don't send keys
-                    if (!libevdev_has_event_type(event_device, EV_KEY))
-                        return true;
-
-                    // disable all events, and only enable the one we need
-                    libevdev_disable_event_type(event_device, EV_REL);
-                    libevdev_disable_event_type(event_device, EV_ABS);
-                    libevdev_disable_event_type(event_device, EV_MSC);
-                    libevdev_disable_event_type(event_device, EV_SW);
-                    libevdev_disable_event_type(event_device, EV_LED);
-                    libevdev_disable_event_type(event_device, EV_SND);
-                    libevdev_disable_event_type(event_device, EV_REP);
-                    libevdev_disable_event_type(event_device, EV_FF);
-                    libevdev_disable_event_type(event_device, EV_PWR);
-                    libevdev_disable_event_type(event_device, EV_FF_STATUS);
-                    if (!keyboard)
-                    {
-                        for (int i = 0; i < 256; ++i)
-                            libevdev_disable_event_code(event_device, EV_KEY, i);
-                    }
-                    if (!mouse)
-                    {
-                        for (int i = BTN_LEFT; i <= BTN_TASK; ++i)
-                            libevdev_disable_event_code(event_device, EV_KEY, i);
-                    }
-                    if (!gamepad)
-                    {
-                        // TODO: fill in gamepad codes
-                    }
-                    libevdev_set_clock_id(event_device, CLOCK_MONOTONIC);
-                    dev.event_device = event_device;
-                    event_device = nullptr;
-                    m_logger->debug("Opened device {}", path);
+                    if (dev.key_state[code] != pressed)
+                        dev.frame_keys.push_back({ .timestamp = timestamp, .code = code, .pressed = pressed });
                 }
-                devices.push_back(&dev);
-                pollfds.emplace_back(libevdev_get_fd(dev.event_device), POLLIN, 0);
-                return false;
-            });
+            };
+            if (ev.code == ABS_HAT0X)
+                set_hat(BTN_DPAD_LEFT, BTN_DPAD_RIGHT);
+            else if (ev.code == ABS_HAT0Y)
+                set_hat(BTN_DPAD_UP, BTN_DPAD_DOWN);
+            else
+            {
+                auto it = std::find_if(evdev_gamepad_axes.begin(), evdev_gamepad_axes.end(),
+                    [&](auto& entry) { return entry.first == ev.code; });
+                if (it != evdev_gamepad_axes.end())
+                    dev.frame_axes.push_back({ it->second, ev.value });
+            }
+            continue;
+        }
+        if (ev.type != EV_KEY || ev.value == 2)
+            continue;
+        // the kernel mask normally drops disabled codes already, this covers
+        // kernels without EVIOCSMASK
+        if (!libevdev_has_event_code(dev.event_device, EV_KEY, ev.code))
+            continue;
+        dev.frame_keys.push_back({
+            .timestamp = timestamp,
+            .code = ev.code,
+            .pressed = ev.value != 0
+        });
+    }
+}
+
+recorder_linux_libevdev::reader_shard::reader_shard()
+{
+    wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeup_fd < 0)
+        throw std::runtime_error("Failed to create wakeup event");
+}
+
+recorder_linux_libevdev::reader_shard::~reader_shard()
+{
+    close(wakeup_fd);
+}
+
+recorder_linux_libevdev::epoll_shard::~epoll_shard()
+{
+    if (epoll_fd >= 0)
+        close(epoll_fd);
+}
+
+std::unique_ptr<recorder_linux_libevdev::reader_shard> recorder_linux_libevdev::_create_shard()
+{
+    auto shard = std::make_unique<epoll_shard>();
+    shard->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (shard->epoll_fd < 0)
+        throw std::runtime_error("Failed to create epoll instance");
+
+    // The wakeup eventfd is the only entry without a device attached
+    epoll_event wakeup_event{
+        .events = EPOLLIN,
+        .data = { .ptr = nullptr }
+    };
+    if (epoll_ctl(shard->epoll_fd, EPOLL_CTL_ADD, shard->wakeup_fd, &wakeup_event) != 0)
+        throw std::runtime_error("Failed to register wakeup event");
+    return shard;
+}
+
+bool recorder_linux_libevdev::_watch(reader_shard& shard, internal_device& dev)
+{
+    auto& epoll = static_cast<epoll_shard&>(shard);
+    epoll_event device_event{
+        .events = EPOLLIN,
+        .data = { .ptr = &dev }
+    };
+    if (epoll_ctl(epoll.epoll_fd, EPOLL_CTL_ADD, libevdev_get_fd(dev.event_device), &device_event) != 0)
+        return false;
+    epoll.devices.push_back(&dev);
+    return true;
+}
+
+void recorder_linux_libevdev::_unwatch(reader_shard& shard, internal_device& dev)
+{
+    auto& epoll = static_cast<epoll_shard&>(shard);
+    epoll_ctl(epoll.epoll_fd, EPOLL_CTL_DEL, libevdev_get_fd(dev.event_device), nullptr);
+    std::erase(epoll.devices, &dev);
+}
 
-            // poll all the devices
-            int poll_res = poll(pollfds.data(), pollfds.size(), 1);
-            if (poll_res == 0)
+// One read() per wakeup drains as many events as the buffer fits. Returns
+// whether there were any.
+bool recorder_linux_libevdev::_read_device(reader_shard& shard, internal_device& dev)
+{
+    int fd = libevdev_get_fd(dev.event_device);
+    std::array<input_event, 64> events;
+    bool any = false;
+    while (true)
+    {
+        auto len = read(fd, events.data(), sizeof(events));
+        if (len < 0)
+        {
+            if (errno == EINTR)
                 continue;
-            if (poll_res < 0)
-                // an error happened, we might want to log this
+            if (errno != EAGAIN)
+            {
+                // the device is gone, stop watching it so epoll doesn't keep
+                // reporting it. It is closed once its removal comes in.
+                _unwatch(shard, dev);
+            }
+            break;
+        }
+        any = true;
+        if (m_options.BusyPoll)
+            dev.receive_timestamp = clock_usec(m_clock);
+        std::size_t count = len / sizeof(input_event);
+        _process_events(dev, std::span(events.data(), count));
+        // a short read means the kernel buffer is empty, skip the read() that would return EAGAIN
+        if (count < events.size())
+            break;
+    }
+    _deliver(dev);
+    return any;
+}
+
+void recorder_linux_libevdev::_run_shard(reader_shard& shard, const std::stop_token& stop)
+{
+    auto& epoll = static_cast<epoll_shard&>(shard);
+
+    _sync_devices(shard);
+    if (m_options.BusyPoll)
+    {
+        _run_busy_poll(epoll, stop);
+        return;
+    }
+    std::array<epoll_event, 64> events;
+    while (!stop.stop_requested())
+    {
+        // block until either a device has inputs, or we're woken up for hotplug/stop
+        int count = epoll_wait(epoll.epoll_fd, events.data(), events.size(), -1);
+        if (count < 0)
+        {
+            if (errno == EINTR)
                 continue;
+            m_logger->error("Failed to wait for device events: {}", std::strerror(errno));
+            break;
+        }
 
-            // check which device has inputs
-            for (int i = 0; i < pollfds.size(); ++i)
+        bool hotplug = false;
+        for (auto& event: std::span(events.data(), count))
+        {
+            if (!event.data.ptr)
             {
-                if (!(pollfds[i].revents | POLLIN))
-                    continue;
-                auto device = devices[i]->event_device;
-                auto& syspath = devices[i]->syspath;
-                input_event ev;
-                int rc, flags = LIBEVDEV_READ_FLAG_NORMAL;
-                std::uint16_t vid = libevdev_get_id_vendor(device);
-                std::uint16_t pid = libevdev_get_id_product(device);
-                while (true)
-                {
-                    rc = libevdev_next_event(device, flags, &ev);
-                    if (rc == LIBEVDEV_READ_STATUS_SUCCESS)
-                    {
-                        if (ev.type != EV_KEY || ev.value == 2)
-                            continue;
-                        OnInput()(syspath, vid, pid, Input{
-                            .Timestamp = (ev.input_event_sec * 1000000ULL + ev.input_event_usec - ref_usec),
-                            .Pressed = static_cast<bool>(ev.value),
-                            .Code = evdev_to_keycode(ev.code)
-                        });
-                        continue;
-                    }
-                    else if (rc == LIBEVDEV_READ_STATUS_SYNC)
-                    {
-                        flags = LIBEVDEV_READ_FLAG_SYNC;
-                        continue;
-                    }
-                    else if (rc == -EAGAIN)
-                    {
-                        flags = LIBEVDEV_READ_FLAG_NORMAL;
-                    }
-                    break;
-                }
+                eventfd_t value;
+                eventfd_read(shard.wakeup_fd, &value);
+                hotplug = true;
+                continue;
             }
+            _read_device(shard, *static_cast<internal_device*>(event.data.ptr));
         }
-    });
+        if (hotplug)
+            _sync_devices(shard);
+    }
 }
 
-recorder_linux_libevdev::recorder_linux_libevdev(std::shared_ptr<spdlog::logger> logger):
-    Recorder::Impl(logger)
+// Reads every device of the shard in turn without ever waiting on the kernel,
+// so inputs are picked up as soon as they're queued rather than after a
+// wakeup. Once the devices go quiet the reader optionally backs off, and the
+// CPU share cap sleeps out the rest of each window once it's used up.
+void recorder_linux_libevdev::_run_busy_poll(epoll_shard& shard, const std::stop_token& stop)
+{
+    auto cpu_share = std::clamp(m_options.BusyPollCpuShare, 1u, 100u);
+    std::uint64_t budget = cpu_share_window * cpu_share / 100;
+    std::uint64_t window_start = clock_usec(CLOCK_MONOTONIC);
+    std::uint64_t window_slept = 0;
+    unsigned idle_rounds = 0;
+    std::uint32_t backoff = 0;
+
+    auto sleep_for = [&](std::uint64_t usec) {
+        timespec duration{
+            .tv_sec = static_cast<time_t>(usec / 1000000),
+            .tv_nsec = static_cast<long>(usec % 1000000 * 1000)
+        };
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &duration, nullptr);
+    };
+
+    while (!stop.stop_requested())
+    {
+        eventfd_t value;
+        if (eventfd_read(shard.wakeup_fd, &value) == 0)
+            _sync_devices(shard);
+
+        bool any = false;
+        // a device whose read fails is unwatched, which drops it from the list
+        for (std::size_t i = 0; i < shard.devices.size(); )
+        {
+            auto dev = shard.devices[i];
+            any |= _read_device(shard, *dev);
+            if (i < shard.devices.size() && shard.devices[i] == dev)
+                ++i;
+        }
+
+        if (any)
+        {
+            idle_rounds = 0;
+            backoff = 0;
+        }
+        else if (m_options.BusyPollBackoff && ++idle_rounds >= busy_poll_spin_rounds)
+        {
+            backoff = std::min(backoff ? backoff * 2 : 1, m_options.BusyPollBackoff);
+            sleep_for(backoff);
+            window_slept += backoff;
+        }
+        else
+            cpu_relax();
+
+        if (cpu_share == 100)
+            continue;
+        auto now = clock_usec(CLOCK_MONOTONIC);
+        auto elapsed = now - window_start;
+        if (elapsed >= cpu_share_window)
+        {
+            window_start = now;
+            window_slept = 0;
+        }
+        else if (elapsed - std::min(window_slept, elapsed) >= budget)
+        {
+            sleep_for(cpu_share_window - elapsed);
+            window_start = clock_usec(CLOCK_MONOTONIC);
+            window_slept = 0;
+        }
+    }
+}
+
+void recorder_linux_libevdev::_init_readers()
+{
+    unsigned count = std::max(m_options.ReaderThreads, 1u);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        auto shard = _create_shard();
+        shard->index = i;
+        m_shards.push_back(std::move(shard));
+    }
+    for (auto& shard_ptr: m_shards)
+    {
+        auto& shard = *shard_ptr;
+        shard.thread = std::jthread([this, &shard](const std::stop_token& stop) {
+            std::stop_callback wake_on_stop(stop, [&]() {
+                eventfd_write(shard.wakeup_fd, 1);
+            });
+            if (shard.index < m_options.ReaderCpus.size() && m_options.ReaderCpus[shard.index] >= 0)
+            {
+                int cpu = m_options.ReaderCpus[shard.index];
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(cpu, &cpus);
+                if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+                    m_logger->warn("Failed to pin reader {} to CPU {}", shard.index, cpu);
+                else
+                    m_logger->debug("Pinned reader {} to CPU {}", shard.index, cpu);
+            }
+            _init_realtime_thread();
+            _run_shard(shard, stop);
+            // a reader that gave up on an error still answers the pause
+            // it was counted in, or Stop would wait for it forever
+            std::lock_guard lock(m_pause_mutex);
+            shard.exited = true;
+            if (shard.pause_generation != m_pause_generation.load(std::memory_order_relaxed))
+                m_pause_done->count_down();
+        });
+    }
+}
+
+void recorder_linux_libevdev::_init_realtime_thread()
+{
+    if (!m_realtime_ready)
+        return;
+    if (!set_realtime_scheduler(m_options.RealTimePriority))
+        m_realtime_scheduler = false;
+    if (!set_min_timer_slack())
+        m_realtime_timer_slack = false;
+    m_realtime_ready->count_down();
+}
+
+recorder_linux_libevdev::recorder_linux_libevdev(std::shared_ptr<spdlog::logger> logger, const RecorderOptions& options):
+    Recorder::Impl(logger), m_options(options), m_clock(to_clockid(options.Clock))
 {
     if (geteuid() != 0)
         m_logger->warn("The program is not running as root. You might not be able to capture inputs");
@@ -290,20 +1001,126 @@ recorder_linux_libevdev::recorder_linux_libevdev(std::shared_ptr<spdlog::logger>
 
 void recorder_linux_libevdev::Start(bool keyboard, bool mouse, bool gamepad)
 {
-    _init_scan_devices();
-    _init_poll(keyboard, mouse, gamepad);
+    // devices are probed for what was asked, a warm reader that watches
+    // something else has to reopen them
+    if (m_armed && (keyboard != m_keyboard || mouse != m_mouse || gamepad != m_gamepad))
+        _disarm();
+    m_keyboard = keyboard;
+    m_mouse = mouse;
+    m_gamepad = gamepad;
+
+    m_ref_usec = clock_usec(m_clock);
+    OnClockSample()(sample_clocks(m_clock, m_ref_usec));
+    if (!m_armed)
+        _arm();
+    m_capturing.store(true, std::memory_order_release);
+}
+
+void recorder_linux_libevdev::_arm()
+{
+    m_realtime_ready.reset();
+    m_realtime_memory_locked = false;
+    if (m_options.RealTime)
+    {
+        // locked before the threads exist, so their stacks are locked as well
+        m_realtime_memory_locked = lock_memory();
+        m_realtime_scheduler = true;
+        m_realtime_timer_slack = true;
+        // the readers and the setup thread
+        m_realtime_ready = std::make_unique<std::latch>(std::max(m_options.ReaderThreads, 1u) + 1);
+    }
+
+    // the setup thread hands devices to the readers, so they have to exist first
+    _init_readers();
+    _init_setup_thread();
+
+    if (m_realtime_ready)
+    {
+        m_realtime_ready->wait();
+        auto status = GetRealTimeStatus();
+        auto applied = [](bool value) { return value ? "applied" : "not applied"; };
+        m_logger->info(
+            "Real-time mode: memory lock {}, SCHED_FIFO priority {} {}, timer slack {}",
+            applied(status.MemoryLocked),
+            m_options.RealTimePriority, applied(status.Scheduler),
+            applied(status.TimerSlack)
+        );
+        if (!status.MemoryLocked || !status.Scheduler || !status.TimerSlack)
+            m_logger->warn("Some real-time settings couldn't be applied. Run as root or grant CAP_SYS_NICE and CAP_IPC_LOCK");
+    }
+    m_armed = true;
 }
 
 void recorder_linux_libevdev::Stop()
 {
-    m_device_scan_thread.request_stop();
-    m_poll_thread.request_stop();
-    m_device_scan_thread.join();
-    m_poll_thread.join();
-    m_evdev_devices.visit_all([](EvdevDeviceMap::value_type& entry) {
-        evdev_close(entry.second.event_device);
+    m_capturing.store(false, std::memory_order_release);
+    if (m_options.WarmStandby)
+        _pause_readers();
+    else
+        _disarm();
+    OnClockSample()(sample_clocks(m_clock, m_ref_usec));
+}
+
+void recorder_linux_libevdev::Shutdown()
+{
+    if (m_armed)
+        _disarm();
+}
+
+// Waits until every reader has seen the capture gate close and flushed what
+// it was still coalescing, so nothing of the recording trickles in after
+// Stop. Devices stay open and their state keeps being tracked.
+void recorder_linux_libevdev::_pause_readers()
+{
+    {
+        std::lock_guard lock(m_pause_mutex);
+        auto running = std::count_if(m_shards.begin(), m_shards.end(), [](const auto& shard) {
+            return !shard->exited;
+        });
+        m_pause_done = std::make_unique<std::latch>(running);
+        m_pause_generation.fetch_add(1, std::memory_order_release);
+    }
+    for (unsigned i = 0; i < m_shards.size(); ++i)
+        _wake(i);
+    m_pause_done->wait();
+}
+
+void recorder_linux_libevdev::_disarm()
+{
+    m_armed = false;
+    m_setup_thread.request_stop();
+    m_setup_thread.join();
+    m_monitor = sd_device_monitor_unref(m_monitor);
+    close(m_setup_wakeup_fd);
+    m_setup_wakeup_fd = -1;
+    for (auto& shard: m_shards)
+        shard->thread.request_stop();
+    for (auto& shard: m_shards)
+        shard->thread.join();
+    m_evdev_devices.visit_all([this](EvdevDeviceMap::value_type& entry) {
+        _flush_motion(*entry.second);
+        _deliver(*entry.second);
+        evdev_close(entry.second->event_device);
     });
     m_evdev_devices.clear();
+    m_shards.clear();
+    if (m_realtime_memory_locked)
+        unlock_memory();
+}
+
+std::optional<CaptureClock> recorder_linux_libevdev::GetCaptureClock() const
+{
+    return m_options.Clock;
+}
+
+RealTimeStatus recorder_linux_libevdev::GetRealTimeStatus() const
+{
+    return RealTimeStatus{
+        .Requested = m_options.RealTime,
+        .MemoryLocked = m_realtime_memory_locked,
+        .Scheduler = m_options.RealTime && m_realtime_scheduler,
+        .TimerSlack = m_options.RealTime && m_realtime_timer_slack
+    };
 }
 
 std::string recorder_linux_libevdev::GetDeviceName(std::string_view syspath) const
@@ -0,0 +1,377 @@
+#include "impl.h"
+#include "clock.h"
+#include "device_name.h"
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <format>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+
+// The binary usbmon interface isn't part of the kernel UAPI headers, these
+// are taken from Documentation/usb/usbmon.rst. usbmon0 sees every bus.
+constexpr const char* usbmon_path = "/dev/usbmon0";
+
+struct usbmon_packet
+{
+    std::uint64_t id;
+    unsigned char type;
+    unsigned char xfer_type;
+    unsigned char epnum;
+    unsigned char devnum;
+    std::uint16_t busnum;
+    char flag_setup;
+    char flag_data;
+    std::int64_t ts_sec;
+    std::int32_t ts_usec;
+    std::int32_t status;
+    std::uint32_t length;
+    std::uint32_t len_cap;
+    union {
+        unsigned char setup[8];
+        struct {
+            std::int32_t error_count;
+            std::int32_t numdesc;
+        } iso;
+    } s;
+    std::int32_t interval;
+    std::int32_t start_frame;
+    std::uint32_t xfer_flags;
+    std::uint32_t ndesc;
+};
+static_assert(sizeof(usbmon_packet) == 64);
+
+struct usbmon_get_arg
+{
+    usbmon_packet* hdr;
+    void* data;
+    std::size_t alloc;
+};
+
+constexpr unsigned long MON_IOCX_GETX = _IOW(0x92, 10, usbmon_get_arg);
+constexpr unsigned char USBMON_COMPLETION = 'C';
+constexpr unsigned char USBMON_INTERRUPT = 1;
+
+// Interrupt transfers of full speed devices are 64 bytes at most, high speed ones 3 KiB
+constexpr std::size_t max_transfer_size = 3072;
+
+static std::uint32_t endpoint_key(std::uint16_t busnum, std::uint8_t devnum, std::uint8_t endpoint)
+{
+    return static_cast<std::uint32_t>(busnum) << 16 | devnum << 8 | endpoint;
+}
+
+recorder_linux_usbmon::recorder_linux_usbmon(std::shared_ptr<spdlog::logger> logger, const RecorderOptions& options):
+    Recorder::Impl(logger), m_options(options)
+{
+    if (access(usbmon_path, F_OK) != 0)
+        throw std::runtime_error("usbmon is not available, load the usbmon module");
+}
+
+// Every USB HID interface, whether it has an evdev node or not. Endpoints
+// found by the previous scan keep their parsed descriptor, only new ones cost
+// more than a sysfs walk.
+usbmon_scan recorder_linux_usbmon::_scan_devices(const usbmon_scan& previous) const
+{
+    usbmon_scan scan;
+    for (auto& interface: enumerate_usb_hid_interfaces())
+    {
+        auto key = endpoint_key(interface.busnum, interface.devnum, interface.endpoint);
+        if (auto it = previous.find(key); it != previous.end() && it->second.usb_device == interface.usb_device)
+        {
+            scan.emplace(key, it->second);
+            continue;
+        }
+        auto descriptor = parse_hid_report_descriptor(interface.report_descriptor);
+        if (!descriptor)
+        {
+            m_logger->warn("Failed to parse the report descriptor of {}", interface.usb_device);
+            continue;
+        }
+        usbmon_scanned_endpoint endpoint{
+            .usb_device = interface.usb_device,
+            .descriptor = std::move(*descriptor)
+        };
+        if (auto info = get_usb_device_info(interface.usb_device))
+        {
+            endpoint.vid = info->VID;
+            endpoint.pid = info->PID;
+        }
+        scan.emplace(key, std::move(endpoint));
+    }
+    return scan;
+}
+
+// Keeps the key state of endpoints that are still there
+void recorder_linux_usbmon::_apply_scan(const usbmon_scan& scan)
+{
+    // an address the bus handed to another device is set up again
+    std::erase_if(m_endpoints, [&](const auto& endpoint) {
+        auto it = scan.find(endpoint.first);
+        return it == scan.end() || it->second.usb_device != endpoint.second.device->syspath;
+    });
+    for (auto& [key, scanned]: scan)
+    {
+        if (m_endpoints.contains(key))
+            continue;
+        hid_key_decoder keys(scanned.descriptor, m_keyboard, m_mouse, m_gamepad);
+        if (keys.empty())
+            continue;
+
+        auto& device = m_devices[scanned.usb_device];
+        if (!device)
+        {
+            device = std::make_unique<usbmon_device>(usbmon_device{
+                .syspath = scanned.usb_device,
+                .vid = scanned.vid,
+                .pid = scanned.pid
+            });
+        }
+        m_logger->debug(
+            "Watching endpoint {:02x} of {} (bus {}, device {})",
+            key & 0xff, scanned.usb_device, key >> 16, (key >> 8) & 0xff
+        );
+        m_endpoints.emplace(key, usbmon_endpoint{ device.get(), std::move(keys) });
+    }
+    std::erase_if(m_devices, [&](const auto& device) {
+        return std::none_of(m_endpoints.begin(), m_endpoints.end(), [&](const auto& endpoint) {
+            return endpoint.second.device == device.second.get();
+        });
+    });
+}
+
+void recorder_linux_usbmon::_run_scanner(const std::stop_token& stop)
+{
+    std::array<pollfd, 2> poll_fds{{
+        { .fd = sd_device_monitor_get_fd(m_monitor), .events = POLLIN },
+        { .fd = m_scanner_wakeup_fd, .events = POLLIN }
+    }};
+    while (!stop.stop_requested())
+    {
+        if (poll(poll_fds.data(), poll_fds.size(), -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            m_logger->error("Failed to wait for new devices: {}", std::strerror(errno));
+            break;
+        }
+        if (!(poll_fds[0].revents & POLLIN))
+            continue;
+        // a plug comes with a burst of uevents, they only tell us to look again
+        bool changed = false;
+        while (true)
+        {
+            __attribute__((cleanup(sd_device_unrefp))) sd_device* device = nullptr;
+            int ret = sd_device_monitor_receive(m_monitor, &device);
+            if (ret < 0)
+                break;
+            if (ret > 0 && device)
+                changed = true;
+        }
+        if (!changed)
+            continue;
+        m_scanned = _scan_devices(m_scanned);
+        {
+            std::lock_guard lock(m_scan_mutex);
+            m_pending_scan = m_scanned;
+        }
+        eventfd_write(m_wakeup_fd, 1);
+    }
+}
+
+void recorder_linux_usbmon::_process_completion(
+    std::uint16_t busnum, std::uint8_t devnum, std::uint8_t endpoint,
+    std::uint64_t timestamp, std::span<const unsigned char> data
+)
+{
+    auto it = m_endpoints.find(endpoint_key(busnum, devnum, endpoint));
+    if (it == m_endpoints.end())
+        return;
+    auto& [device, keys] = it->second;
+    ++device->frame;
+    device->report_batch.push_back(Report{
+        .Timestamp = timestamp,
+        .Frame = device->frame,
+        .Data = m_options.KeepReportData ?
+            std::vector<unsigned char>(data.begin(), data.end()) :
+            std::vector<unsigned char>{}
+    });
+    for (auto [code, pressed]: keys.update(data))
+    {
+        device->batch.push_back(Input{
+            .Timestamp = timestamp,
+            .Pressed = pressed,
+            .Code = code,
+            .Frame = device->frame
+        });
+    }
+}
+
+void recorder_linux_usbmon::_run(const std::stop_token& stop)
+{
+    std::array<pollfd, 2> poll_fds{{
+        { .fd = m_usbmon_fd, .events = POLLIN },
+        { .fd = m_wakeup_fd, .events = POLLIN }
+    }};
+    std::array<unsigned char, max_transfer_size> data;
+    clock_sampler sampler(CLOCK_REALTIME, m_options.ClockSampleInterval);
+    while (!stop.stop_requested())
+    {
+        if (poll(poll_fds.data(), poll_fds.size(), sampler.timeout()) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            m_logger->error("Failed to wait for USB events: {}", std::strerror(errno));
+            break;
+        }
+        if (auto sample = sampler.poll(m_ref_usec))
+            OnClockSample()(*sample);
+        if (poll_fds[1].revents & POLLIN)
+        {
+            eventfd_t value;
+            eventfd_read(m_wakeup_fd, &value);
+            std::optional<usbmon_scan> scan;
+            {
+                std::lock_guard lock(m_scan_mutex);
+                scan.swap(m_pending_scan);
+            }
+            if (scan)
+                _apply_scan(*scan);
+        }
+        if (!(poll_fds[0].revents & POLLIN))
+            continue;
+
+        while (true)
+        {
+            usbmon_packet packet;
+            usbmon_get_arg arg{ .hdr = &packet, .data = data.data(), .alloc = data.size() };
+            if (ioctl(m_usbmon_fd, MON_IOCX_GETX, &arg) != 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN)
+                    m_logger->error("Failed to read from usbmon: {}", std::strerror(errno));
+                break;
+            }
+            // Completed interrupt IN transfers are the reports the host
+            // controller polled from the device
+            if (
+                packet.type != USBMON_COMPLETION ||
+                packet.xfer_type != USBMON_INTERRUPT ||
+                !(packet.epnum & 0x80) ||
+                packet.status != 0 ||
+                packet.flag_data != 0
+            )
+                continue;
+            std::uint64_t timestamp = packet.ts_sec * 1000000ULL + packet.ts_usec;
+            if (timestamp < m_ref_usec)
+                continue;
+            _process_completion(
+                packet.busnum, packet.devnum, packet.epnum, timestamp - m_ref_usec,
+                std::span(data.data(), std::min<std::size_t>(packet.len_cap, data.size()))
+            );
+        }
+        for (auto& [syspath, device]: m_devices)
+        {
+            _emit_reports(device->sink, syspath, device->vid, device->pid, device->report_batch);
+            _emit_inputs(device->sink, syspath, device->vid, device->pid, device->batch);
+            device->report_batch.clear();
+            device->batch.clear();
+        }
+    }
+}
+
+void recorder_linux_usbmon::Start(bool keyboard, bool mouse, bool gamepad)
+{
+    m_keyboard = keyboard;
+    m_mouse = mouse;
+    m_gamepad = gamepad;
+
+    m_usbmon_fd = open(usbmon_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (m_usbmon_fd < 0)
+        throw std::runtime_error(std::format("Failed to open {}: {}", usbmon_path, std::strerror(errno)));
+    m_wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    m_scanner_wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_wakeup_fd < 0 || m_scanner_wakeup_fd < 0)
+        throw std::runtime_error("Failed to initialize the usbmon reader");
+    if (int ret = sd_device_monitor_new(&m_monitor); ret < 0)
+        throw std::runtime_error(std::format("Failed to create device monitor: {}", std::strerror(-ret)));
+    // the report descriptor is there once the HID device is
+    sd_device_monitor_filter_add_match_subsystem_devtype(m_monitor, "hid", nullptr);
+    sd_device_monitor_filter_update(m_monitor);
+
+    // The devices that are already there are set up before the reader starts,
+    // anything plugged in from now on is queued on the monitor
+    m_scanned = _scan_devices({});
+    _apply_scan(m_scanned);
+    // taken after opening, so the URBs buffered before are dropped
+    m_ref_usec = clock_usec(CLOCK_REALTIME);
+    OnClockSample()(sample_clocks(CLOCK_REALTIME, m_ref_usec));
+
+    m_scanner_thread = std::jthread([this](const std::stop_token& stop) {
+        std::stop_callback wake_on_stop(stop, [this]() {
+            eventfd_write(m_scanner_wakeup_fd, 1);
+        });
+        _run_scanner(stop);
+    });
+    m_reader_thread = std::jthread([this](const std::stop_token& stop) {
+        std::stop_callback wake_on_stop(stop, [this]() {
+            eventfd_write(m_wakeup_fd, 1);
+        });
+        _run(stop);
+    });
+}
+
+void recorder_linux_usbmon::Stop()
+{
+    m_scanner_thread.request_stop();
+    m_scanner_thread.join();
+    m_reader_thread.request_stop();
+    m_reader_thread.join();
+    m_endpoints.clear();
+    m_devices.clear();
+    m_scanned.clear();
+    m_pending_scan.reset();
+    m_monitor = sd_device_monitor_unref(m_monitor);
+    close(m_scanner_wakeup_fd);
+    close(m_wakeup_fd);
+    close(m_usbmon_fd);
+    m_scanner_wakeup_fd = m_wakeup_fd = m_usbmon_fd = -1;
+    OnClockSample()(sample_clocks(CLOCK_REALTIME, m_ref_usec));
+}
+
+// usbmon stamps URBs with the wall clock, and there is no other to choose
+std::optional<CaptureClock> recorder_linux_usbmon::GetCaptureClock() const
+{
+    return CaptureClock::REALTIME;
+}
+
+std::string recorder_linux_usbmon::GetDeviceName(std::string_view syspath) const
+{
+    return device_name_from_usb(syspath);
+}
+
+std::optional<std::string> recorder_linux_usbmon::GetUsbDeviceId(std::string_view id) const
+{
+    // devices are recorded under their USB device already
+    return std::string(id);
+}
+
+std::optional<UsbDeviceInfo> recorder_linux_usbmon::GetUsbDeviceInfo(std::string_view id) const
+{
+    return get_usb_device_info(id);
+}
@@ -13,7 +13,7 @@
 
 using namespace std::literals;
 
-Recorder::Recorder(RecorderBackend backend, std::shared_ptr<spdlog::logger> logger):
+Recorder::Recorder(RecorderBackend backend, std::shared_ptr<spdlog::logger> logger, const RecorderOptions& options):
     m_logger(logger ? logger : spdlog::default_logger())
 {
 #ifdef _WIN32
@@ -31,7 +31,7 @@ Recorder::Recorder(RecorderBackend backend, std::shared_ptr<spdlog::logger> logg
             m_logger->info("Initialized GameInput backend");
         }
         catch (const std::exception& e) {
-            m_logger->info("Failed to initialize GameInput backend");
+            m_logger->info("Failed to initialize GameInput backend: {}", e.what());
         }
     }
     if (
@@ -48,12 +48,29 @@ Recorder::Recorder(RecorderBackend backend, std::shared_ptr<spdlog::logger> logg
             m_logger->info("Initialized Raw Input backend");
         }
         catch (const std::exception& e) {
-            m_logger->info("Failed to initialize Raw Input backend");
+            m_logger->info("Failed to initialize Raw Input backend: {}", e.what());
         }
     }
 #endif
 
 #ifdef __linux__
+    if (
+        !p_impl && (
+            backend == RecorderBackend::AUTO ||
+            backend == RecorderBackend::LINUX_IO_URING
+        )
+    )
+    {
+        try {
+            m_logger->info("Trying to initialize io_uring backend");
+            p_impl = std::make_unique<recorder_linux_io_uring>(logger, options);
+            m_backend = RecorderBackend::LINUX_IO_URING;
+            m_logger->info("Initialized io_uring backend");
+        }
+        catch (const std::exception& e) {
+            m_logger->info("Failed to initialize io_uring backend: {}", e.what());
+        }
+    }
     if (
         !p_impl && (
             backend == RecorderBackend::AUTO ||
@@ -63,12 +80,38 @@ Recorder::Recorder(RecorderBackend backend, std::shared_ptr<spdlog::logger> logg
     {
         try {
             m_logger->info("Trying to initialize evdev backend");
-            p_impl = std::make_unique<recorder_linux_libevdev>(logger);
+            p_impl = std::make_unique<recorder_linux_libevdev>(logger, options);
             m_backend = RecorderBackend::LINUX_EVDEV;
             m_logger->info("Initialized evdev backend");
         }
         catch (const std::exception& e) {
-            m_logger->info("Failed to initialize evdev backend");
+            m_logger->info("Failed to initialize evdev backend: {}", e.what());
+        }
+    }
+    // hidraw and usbmon only see HID devices and record every report, not
+    // just state changes, so the auto-probe never picks them
+    if (!p_impl && backend == RecorderBackend::LINUX_HIDRAW)
+    {
+        try {
+            m_logger->info("Trying to initialize hidraw backend");
+            p_impl = std::make_unique<recorder_linux_hidraw>(logger, options);
+            m_backend = RecorderBackend::LINUX_HIDRAW;
+            m_logger->info("Initialized hidraw backend");
+        }
+        catch (const std::exception& e) {
+            m_logger->info("Failed to initialize hidraw backend: {}", e.what());
+        }
+    }
+    if (!p_impl && backend == RecorderBackend::LINUX_USBMON)
+    {
+        try {
+            m_logger->info("Trying to initialize usbmon backend");
+            p_impl = std::make_unique<recorder_linux_usbmon>(logger, options);
+            m_backend = RecorderBackend::LINUX_USBMON;
+            m_logger->info("Initialized usbmon backend");
+        }
+        catch (const std::exception& e) {
+            m_logger->info("Failed to initialize usbmon backend: {}", e.what());
         }
     }
 #endif
@@ -79,49 +122,176 @@ Recorder::Recorder(RecorderBackend backend, std::shared_ptr<spdlog::logger> logg
         throw std::runtime_error("Failed to initialize any backend");
     }
 
+    p_impl->SetAttach([this](
+        Impl::DeviceSink& sink, const std::string& id, std::uint16_t vid, std::uint16_t pid
+    ) {
+        sink.handle = _add_device(id, vid, pid);
+        auto& entry = m_registry[sink.handle];
+        sink.inputs = entry.Inputs;
+        sink.reports = entry.Reports;
+        sink.axes = entry.Axes;
+    });
     p_impl->OnInput().connect([this](
-        const std::string& id, std::uint16_t vid, std::uint16_t pid, Input input
+        DeviceHandle handle, InputBuffer& buffer, std::span<const Input> inputs
     ) {
-        m_devices.try_emplace_and_visit(
-            id,
-            ""s, vid, pid, std::nullopt,
-            [&, this](DeviceMap::value_type& new_device) {
-                new_device.second.Name = p_impl->GetDeviceName(id);
-                auto usbDevice = p_impl->GetUsbDeviceId(id);
-                if (usbDevice)
-                {
-                    new_device.second.UsbDeviceId = usbDevice;
-                    m_usb_devices.try_emplace_and_visit(
-                        usbDevice.value(), std::nullopt,
-                        [&, this](UsbDeviceMap::value_type& new_usb_device)
-                        {
-                            auto& [id, device] = new_usb_device;
-                            device = std::move(p_impl->GetUsbDeviceInfo(id));
-                            if (device)
-                                this->OnUsbDevice()(id, device.value());
-                        },
-                        [](auto& _)
-                        {
-                        }
-                    );
-                }
-                this->OnDevice()(id, new_device.second);
-            },
-            [](const DeviceMap::value_type& existing_device) {
-
-            }
+        if (!this->OnInput().empty())
+        {
+            for (auto& input: inputs)
+                this->OnInput()(handle, input);
+        }
+        buffer.append(inputs);
+        m_registry[handle].Rate->add(RateCounter::clock::now(), inputs.size());
+        m_input_count.fetch_add(inputs.size(), std::memory_order_relaxed);
+    });
+    p_impl->OnReport().connect([](
+        DeviceHandle handle, ReportBuffer& buffer, std::span<const Report> reports
+    ) {
+        buffer.append(reports);
+    });
+    p_impl->OnAxis().connect([](
+        DeviceHandle handle, AxisBuffer& buffer, std::span<const AxisSample> samples
+    ) {
+        buffer.append(samples);
+    });
+    p_impl->OnGap().connect([this](const std::string& id, const InputGap& gap) {
+        m_logger->warn(
+            "Device {} dropped inputs between {}us and {}us, synthesized {} inputs",
+            id, gap.Start, gap.End, gap.Synthesized
         );
-        auto process_input = [&, this](InputMap::value_type& input_arr) {
-            this->OnInput()(id, input);
-            input_arr.second.push_back(input);
+        auto add_gap = [&](OverflowMap::value_type& entry) {
+            auto& stats = entry.second;
+            ++stats.Drops;
+            if (gap.Resynced)
+                ++stats.Resyncs;
+            stats.Synthesized += gap.Synthesized;
+            stats.Gaps.push_back(gap);
         };
-        m_inputs.try_emplace_and_visit(
-            id, 0, process_input, process_input
-        );
+        m_overflows.try_emplace_and_visit(id, add_gap, add_gap);
+    });
+    p_impl->OnClockSample().connect([this](const ClockSample& sample) {
+        std::lock_guard lock(m_clock_mutex);
+        m_clock_samples.push_back(sample);
+    });
+    m_resolver_thread = std::jthread([this](const std::stop_token& stop) {
+        _resolve_devices(stop);
+    });
+}
+
+// Every device gets its handle and input buffer when it's first seen, so
+// inputs never have to look it up by ID
+DeviceHandle Recorder::_add_device(const std::string& id, std::uint16_t vid, std::uint16_t pid)
+{
+    DeviceHandle handle = 0;
+    m_devices.try_emplace_and_visit(
+        id,
+        ""s, vid, pid, std::nullopt,
+        [&, this](DeviceMap::value_type& new_device) {
+            InputBuffer* inputs = nullptr;
+            m_inputs.try_emplace_and_visit(
+                id, std::make_unique<InputBuffer>(),
+                [&](InputMap::value_type& entry) {
+                    inputs = entry.second.get();
+                },
+                [&](InputMap::value_type& entry) {
+                    inputs = entry.second.get();
+                }
+            );
+            {
+                std::lock_guard lock(m_registry_mutex);
+                handle = static_cast<DeviceHandle>(m_registry.size());
+                auto reports = std::make_unique<ReportBuffer>();
+                auto axes = std::make_unique<AxisBuffer>();
+                auto& rate = m_rates.emplace_back();
+                m_registry.push_back(DeviceEntry{
+                    .Id = id,
+                    .Inputs = inputs,
+                    .Reports = reports.get(),
+                    .Axes = axes.get(),
+                    .Rate = &rate
+                });
+                m_reports.emplace(handle, std::move(reports));
+                m_axes.emplace(handle, std::move(axes));
+            }
+            new_device.second.Handle = handle;
+            {
+                std::lock_guard lock(m_resolver_mutex);
+                m_resolve_queue.emplace_back(id, vid, pid);
+            }
+            m_resolver_cv.notify_all();
+        },
+        [&](const DeviceMap::value_type& existing_device) {
+            handle = existing_device.second.Handle;
+        }
+    );
+    return handle;
+}
+
+void Recorder::_resolve_devices(const std::stop_token& stop)
+{
+    std::unique_lock lock(m_resolver_mutex);
+    while (m_resolver_cv.wait(lock, stop, [this]() { return !m_resolve_queue.empty(); }))
+    {
+        auto [id, vid, pid] = std::move(m_resolve_queue.front());
+        m_resolve_queue.pop_front();
+        m_resolving = true;
+        lock.unlock();
+        _resolve_device(id, vid, pid);
+        lock.lock();
+        m_resolving = false;
+        m_resolver_cv.notify_all();
+    }
+}
+
+void Recorder::_resolve_device(const std::string& id, std::uint16_t vid, std::uint16_t pid)
+{
+    DeviceKey key(id, vid, pid);
+    auto cached = m_metadata_cache.find(key);
+    if (cached == m_metadata_cache.end())
+    {
+        DeviceMetadata metadata;
+        try {
+            metadata.Name = p_impl->GetDeviceName(id);
+            metadata.UsbDeviceId = p_impl->GetUsbDeviceId(id);
+            if (metadata.UsbDeviceId)
+                metadata.UsbDevice = p_impl->GetUsbDeviceInfo(*metadata.UsbDeviceId);
+        }
+        catch (const std::exception& e) {
+            // not cached, the next time the device shows up gets another try
+            m_logger->warn("Failed to look up device {}: {}", id, e.what());
+            return;
+        }
+        cached = m_metadata_cache.emplace(std::move(key), std::move(metadata)).first;
+    }
+    auto& metadata = cached->second;
+
+    if (metadata.UsbDeviceId && m_usb_devices.emplace(*metadata.UsbDeviceId, metadata.UsbDevice) && metadata.UsbDevice)
+        OnUsbDevice()(*metadata.UsbDeviceId, *metadata.UsbDevice);
+    std::optional<Device> device;
+    m_devices.visit(id, [&](DeviceMap::value_type& entry) {
+        entry.second.Name = metadata.Name;
+        entry.second.UsbDeviceId = metadata.UsbDeviceId;
+        device = entry.second;
     });
+    if (device)
+        OnDevice()(device->Handle, id, *device);
+}
+
+// Lets Stop hand out complete devices
+void Recorder::_wait_resolved()
+{
+    std::unique_lock lock(m_resolver_mutex);
+    m_resolver_cv.wait(lock, [this]() { return m_resolve_queue.empty() && !m_resolving; });
 }
 
-Recorder::~Recorder() = default;
+Recorder::~Recorder()
+{
+    m_resolver_thread.request_stop();
+    m_resolver_thread.join();
+    if (m_running)
+        p_impl->Stop();
+    // backends in warm standby keep their readers and devices until now
+    p_impl->Shutdown();
+}
 
 bool Recorder::Recording() const
 {
@@ -135,6 +305,18 @@ void Recorder::Start(bool keyboard, bool mouse, bool gamepad)
     m_running = true;
     m_devices.clear();
     m_inputs.clear();
+    m_registry.clear();
+    m_rates.clear();
+    m_input_count = 0;
+    m_session.fetch_add(1, std::memory_order_release);
+    p_impl->ResetAttachments();
+    m_overflows.clear();
+    m_reports.clear();
+    m_axes.clear();
+    {
+        std::lock_guard lock(m_clock_mutex);
+        m_clock_samples.clear();
+    }
     p_impl->Start(keyboard, mouse, gamepad);
     m_start_time = std::chrono::steady_clock::now();
     m_start_wallclock = std::chrono::system_clock::now();
@@ -147,6 +329,7 @@ void Recorder::Stop()
     if (!m_running)
         return;
     p_impl->Stop();
+    _wait_resolved();
     m_end_time = std::chrono::steady_clock::now();
     m_running = false;
     m_logger->debug("Stopped recording");
@@ -155,7 +338,16 @@ void Recorder::Stop()
 
 std::chrono::system_clock::time_point Recorder::StartTime() const
 {
-    return m_start_wallclock;
+    // The wall-clock time of timestamp 0, from the clock sample taken by the
+    // backend along with its reference. m_start_wallclock is read a while later.
+    std::lock_guard lock(m_clock_mutex);
+    if (m_clock_samples.empty())
+        return m_start_wallclock;
+    auto& sample = m_clock_samples.front();
+    auto realtime = std::chrono::nanoseconds(sample.Realtime) - std::chrono::microseconds(sample.Timestamp);
+    return std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(realtime)
+    );
 }
 
 std::chrono::steady_clock::duration Recorder::Elapsed() const
@@ -169,6 +361,22 @@ RecorderBackend Recorder::Backend() const
     return m_backend;
 }
 
+RealTimeStatus Recorder::RealTime() const
+{
+    return p_impl->GetRealTimeStatus();
+}
+
+std::optional<CaptureClock> Recorder::Clock() const
+{
+    return p_impl->GetCaptureClock();
+}
+
+std::vector<ClockSample> Recorder::ClockSamples() const
+{
+    std::lock_guard lock(m_clock_mutex);
+    return m_clock_samples;
+}
+
 const Recorder::UsbDeviceMap& Recorder::UsbDevices() const
 {
     return m_usb_devices;
@@ -184,6 +392,41 @@ const Recorder::InputMap& Recorder::Inputs() const
     return m_inputs;
 }
 
+const std::string& Recorder::DeviceId(DeviceHandle handle) const
+{
+    return m_registry[handle].Id;
+}
+
+const Recorder::InputBuffer& Recorder::Inputs(DeviceHandle handle) const
+{
+    return *m_registry[handle].Inputs;
+}
+
+const Recorder::OverflowMap& Recorder::Overflows() const
+{
+    return m_overflows;
+}
+
+const Recorder::ReportMap& Recorder::Reports() const
+{
+    return m_reports;
+}
+
+const Recorder::ReportBuffer& Recorder::Reports(DeviceHandle handle) const
+{
+    return *m_registry[handle].Reports;
+}
+
+const Recorder::AxisMap& Recorder::Axes() const
+{
+    return m_axes;
+}
+
+const Recorder::AxisBuffer& Recorder::Axes(DeviceHandle handle) const
+{
+    return *m_registry[handle].Axes;
+}
+
 size_t Recorder::DeviceCount() const
 {
     return m_devices.size();
@@ -191,9 +434,24 @@ size_t Recorder::DeviceCount() const
 
 size_t Recorder::InputCount() const
 {
-    size_t count = 0;
-    m_inputs.visit_all([&](const InputMap::value_type& input) {
-        count += input.second.size();
-    });
-    return count;
+    return m_input_count.load(std::memory_order_relaxed);
+}
+
+size_t Recorder::InputCount(DeviceHandle handle) const
+{
+    return m_registry[handle].Inputs->size();
+}
+
+double Recorder::InputRate(std::chrono::milliseconds window) const
+{
+    auto now = RateCounter::clock::now();
+    double rate = 0;
+    for (auto& device: m_registry)
+        rate += device.Rate->rate(now, window);
+    return rate;
+}
+
+double Recorder::InputRate(DeviceHandle handle, std::chrono::milliseconds window) const
+{
+    return m_registry[handle].Rate->rate(RateCounter::clock::now(), window);
 }
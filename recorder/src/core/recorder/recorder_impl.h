@@ -1,33 +1,149 @@
 #pragma once
 
 #include <recorder.h>
+#include <atomic>
+#include <functional>
+#include <span>
 #include <spdlog/fwd.h>
 
 class Recorder::Impl
 {
 public:
-    using InputSignalWithVIDPID =
-        boost::signals2::signal<void(const std::string&, std::uint16_t, std::uint16_t, Input)>;
+    // Inputs come in batches of one device, with the handle and buffer the
+    // backend resolved once through _attach
+    using InputSignalWithBuffer =
+        boost::signals2::signal<void(DeviceHandle, InputBuffer&, std::span<const Input>)>;
+    // Reports and axis samples come the same way
+    using ReportSignalWithBuffer =
+        boost::signals2::signal<void(DeviceHandle, ReportBuffer&, std::span<const Report>)>;
+    using AxisSignalWithBuffer =
+        boost::signals2::signal<void(DeviceHandle, AxisBuffer&, std::span<const AxisSample>)>;
+    using GapSignal = boost::signals2::signal<void(const std::string&, const InputGap&)>;
+    using ClockSignal = boost::signals2::signal<void(const ClockSample&)>;
+
+    // Where a backend keeps the handle and buffers of one of its devices, so
+    // it only has to look the device up once per recording
+    struct DeviceSink
+    {
+        DeviceHandle handle = 0;
+        InputBuffer* inputs = nullptr;
+        ReportBuffer* reports = nullptr;
+        AxisBuffer* axes = nullptr;
+        unsigned generation = 0;
+    };
+
+    // Fills in the sink of a device, registering the device when it's new.
+    // Set by Recorder.
+    using AttachFunction =
+        std::function<void(DeviceSink&, const std::string&, std::uint16_t, std::uint16_t)>;
 
     Impl(std::shared_ptr<spdlog::logger> logger): m_logger(logger) {}
     virtual ~Impl() = default;
     Impl(const Impl&) = delete;
     Impl& operator=(const Impl&) = delete;
 
-    InputSignalWithVIDPID& OnInput()
+    InputSignalWithBuffer& OnInput()
     {
         return m_sig_input;
     }
+    ReportSignalWithBuffer& OnReport()
+    {
+        return m_sig_report;
+    }
+    AxisSignalWithBuffer& OnAxis()
+    {
+        return m_sig_axis;
+    }
+    GapSignal& OnGap()
+    {
+        return m_sig_gap;
+    }
+    ClockSignal& OnClockSample()
+    {
+        return m_sig_clock;
+    }
+
+    void SetAttach(AttachFunction attach)
+    {
+        m_attach = std::move(attach);
+    }
+    // The buffers of the last recording are gone, every sink has to attach again
+    void ResetAttachments()
+    {
+        m_attach_generation.fetch_add(1, std::memory_order_release);
+    }
 
     virtual void Start(bool keyboard = true, bool mouse = false, bool gamepad = false) = 0;
     virtual void Stop() = 0;
+    // Releases what the backend keeps open between recordings
+    virtual void Shutdown() {}
     virtual std::string GetDeviceName(std::string_view id) const = 0;
     virtual std::optional<std::string> GetUsbDeviceId(std::string_view id) const = 0;
     virtual std::optional<UsbDeviceInfo> GetUsbDeviceInfo(std::string_view id) const = 0;
+    virtual RealTimeStatus GetRealTimeStatus() const
+    {
+        return {};
+    }
+    virtual std::optional<CaptureClock> GetCaptureClock() const
+    {
+        return std::nullopt;
+    }
 
 protected:
+    DeviceSink& _attach(DeviceSink& sink, const std::string& id, std::uint16_t vid, std::uint16_t pid)
+    {
+        auto generation = m_attach_generation.load(std::memory_order_acquire);
+        if (!sink.inputs || sink.generation != generation)
+        {
+            m_attach(sink, id, vid, pid);
+            sink.generation = generation;
+        }
+        return sink;
+    }
+    // Backends hand over everything a device produced in one wakeup at once
+    void _emit_inputs(
+        DeviceSink& sink, const std::string& id, std::uint16_t vid, std::uint16_t pid,
+        std::span<const Input> inputs
+    )
+    {
+        if (inputs.empty())
+            return;
+        auto& attached = _attach(sink, id, vid, pid);
+        m_sig_input(attached.handle, *attached.inputs, inputs);
+    }
+    void _emit_input(DeviceSink& sink, const std::string& id, std::uint16_t vid, std::uint16_t pid, const Input& input)
+    {
+        _emit_inputs(sink, id, vid, pid, std::span(&input, 1));
+    }
+    void _emit_reports(
+        DeviceSink& sink, const std::string& id, std::uint16_t vid, std::uint16_t pid,
+        std::span<const Report> reports
+    )
+    {
+        if (reports.empty())
+            return;
+        auto& attached = _attach(sink, id, vid, pid);
+        m_sig_report(attached.handle, *attached.reports, reports);
+    }
+    void _emit_axes(
+        DeviceSink& sink, const std::string& id, std::uint16_t vid, std::uint16_t pid,
+        std::span<const AxisSample> samples
+    )
+    {
+        if (samples.empty())
+            return;
+        auto& attached = _attach(sink, id, vid, pid);
+        m_sig_axis(attached.handle, *attached.axes, samples);
+    }
+
     std::shared_ptr<spdlog::logger> m_logger;
 
 private:
-    InputSignalWithVIDPID m_sig_input;
+    AttachFunction m_attach;
+    std::atomic<unsigned> m_attach_generation = 0;
+    InputSignalWithBuffer m_sig_input;
+    ReportSignalWithBuffer m_sig_report;
+    AxisSignalWithBuffer m_sig_axis;
+    GapSignal m_sig_gap;
+    ClockSignal m_sig_clock;
 };
@@ -28,7 +28,12 @@ private:
     std::jthread m_dispatcher_thread;
     std::uint64_t m_timestamp_ref;
     GameInputCallbackToken m_callback_token;
-    std::unordered_map<std::string, KeyStateArray> m_key_states;
+    struct device_state
+    {
+        KeyStateArray keys;
+        DeviceSink sink;
+    };
+    std::unordered_map<std::string, device_state> m_devices;
 };
 
 class recorder_win_rawinput: public Recorder::Impl
@@ -46,4 +51,5 @@ private:
     HWND m_hwnd = nullptr;
     std::jthread m_window_thread;
     std::chrono::steady_clock::time_point m_start_ref;
+    std::unordered_map<std::string, DeviceSink> m_sinks;
 };
@@ -57,7 +57,8 @@ void recorder_win_gameinput::_update_key_states(
     std::uint64_t timestamp, const KeyStateArray& state
 )
 {
-    auto& state_prev = m_key_states[pnp];
+    auto& device = m_devices[pnp];
+    auto& state_prev = device.keys;
     KeyStateArray pressed;
     KeyStateArray released;
     std::set_difference(
@@ -72,9 +73,11 @@ void recorder_win_gameinput::_update_key_states(
         std::back_inserter(pressed),
         sort_by_scancode
     );
+    std::vector<Input> inputs;
+    inputs.reserve(pressed.size() + released.size());
     for (auto& i : pressed)
     {
-        OnInput()(pnp, vid, pid, Input{
+        inputs.push_back(Input{
             .Timestamp = timestamp - m_timestamp_ref,
             .Pressed = true,
             .Code = static_cast<Keycode>(vk_to_keycode(i.virtualKey))
@@ -82,12 +85,13 @@ void recorder_win_gameinput::_update_key_states(
     }
     for (auto& i : released)
     {
-        OnInput()(pnp, vid, pid, Input{
+        inputs.push_back(Input{
             .Timestamp = timestamp - m_timestamp_ref,
             .Pressed = false,
             .Code = static_cast<Keycode>(vk_to_keycode(i.virtualKey))
         });
     }
+    _emit_inputs(device.sink, pnp, vid, pid, inputs);
     state_prev = state;
 }
 
@@ -139,7 +143,7 @@ void recorder_win_gameinput::Start(bool keyboard, bool mouse, bool gamepad)
     if (gamepad)
         kind |= GameInputKind::GameInputKindGamepad;
     m_timestamp_ref = m_gameinput->GetCurrentTimestamp();
-    m_key_states.clear();
+    m_devices.clear();
     m_dispatcher_thread = std::jthread([&](const std::stop_token& stop) {
         IGameInputDispatcher *dispatcher;
         if (FAILED(m_gameinput->CreateDispatcher(&dispatcher)))
@@ -88,7 +88,7 @@ void recorder_win_rawinput::_processRawInput(HRAWINPUT rawInput)
         if (keyboard.MakeCode == KEYBOARD_OVERRUN_MAKE_CODE || keyboard.VKey >= UCHAR_MAX)
             return;
         auto [ vid, pid ] = vid_pid_from_pnp(pnp);
-        this->OnInput()(pnp, vid, pid, Input{
+        _emit_input(m_sinks[pnp], pnp, vid, pid, Input{
             .Timestamp = static_cast<std::uint64_t>(duration_cast<microseconds>(now - m_start_ref).count()),
             .Pressed = !released,
             .Code = vk_to_keycode(keyboard.VKey)
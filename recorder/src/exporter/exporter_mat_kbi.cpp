@@ -1,5 +1,6 @@
 #include "exporter.h"
 #include <keycode.h>
+#include <algorithm>
 #include <array>
 #include <boost/endian.hpp>
 #include <chrono>
@@ -160,6 +161,18 @@ void Exporter_MatKbi::Export(std::ostream& out)
             write_string(out, CREATOR + " (Backend: Linux evdev)");
             break;
 
+        case RecorderBackend::LINUX_IO_URING:
+            write_string(out, CREATOR + " (Backend: Linux evdev, io_uring)");
+            break;
+
+        case RecorderBackend::LINUX_HIDRAW:
+            write_string(out, CREATOR + " (Backend: Linux hidraw)");
+            break;
+
+        case RecorderBackend::LINUX_USBMON:
+            write_string(out, CREATOR + " (Backend: Linux usbmon)");
+            break;
+
         default:
             write_string(out, CREATOR + " (Backend: Unknown)");
             break;
@@ -189,21 +202,27 @@ void Exporter_MatKbi::Export(std::ostream& out)
     std::list<KbiEvent> kbi_events;
     std::unordered_map<KbiInput, KbiInputInfo> kbi_input_info;
 
-    inputs.visit_all([&](const InputMap::value_type& device) {
+    inputs.cvisit_all([&](const InputMap::value_type& device) {
         auto& [id, events] = device;
-        for (auto& event: events)
-        {
-            KbiInput input{std::string{keycode_to_string(event.Code)}, index_map[id]};
-            kbi_events.emplace_back(
-                event.Timestamp / 1000000.0,
-                event.Pressed,
-                input
-            );
-            kbi_input_info.try_emplace(
-                input,
-                0xFFA9A9A9, true // Default color and visibility
-            );
-        }
+        // only the key columns are read, the rest of the inputs isn't decoded
+        events->visit_columns([&](const Recorder::InputBuffer::column_view& columns) {
+            for (std::size_t i = 0; i < columns.size(); ++i)
+            {
+                // KBI only knows about keys
+                if (columns.kind(i) != InputKind::KEY)
+                    continue;
+                KbiInput input{std::string{keycode_to_string(columns.code(i))}, index_map[id]};
+                kbi_events.emplace_back(
+                    columns.timestamp(i) / 1000000.0,
+                    columns.pressed(i),
+                    input
+                );
+                kbi_input_info.try_emplace(
+                    input,
+                    0xFFA9A9A9, true // Default color and visibility
+                );
+            }
+        });
     });
     write_list(
         out, kbi_events.begin(), kbi_events.end(),
@@ -224,7 +243,14 @@ void Exporter_MatKbi::Export(std::ostream& out)
         [&](std::ostream& out, const std::pair<std::string, Device>& device) {
             write_int64(out, index_map[device.first]);
             inputs.cvisit(device.first, [&](const InputMap::value_type& input) {
-                write_int32(out, input.second.size());
+                // counted from the flags column alone
+                std::int32_t keys = 0;
+                input.second->visit_columns([&](const Recorder::InputBuffer::column_view& columns) {
+                    keys += std::ranges::count_if(columns.flags(), [](std::uint8_t flags) {
+                        return !(flags & Recorder::InputBuffer::motion);
+                    });
+                });
+                write_int32(out, keys);
             });
             write_string(out, device.second.Name);
             write_string(out, device.first);
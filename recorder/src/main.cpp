@@ -8,6 +8,7 @@
 #include <spdlog/sinks/basic_file_sink.h>
 
 #include <cassert>
+#include <charconv>
 #include <exception>
 #include <istream>
 #include <iterator>
@@ -46,10 +47,82 @@ std::istream& operator>>(std::istream& in, ProgramMode& mode) {
     return in;
 }
 
+std::istream& operator>>(std::istream& in, RecorderBackend& backend) {
+    std::string token;
+    in >> token;
+
+    if (token == "auto") {
+        backend = RecorderBackend::AUTO;
+    }
+    else if (token == "gameinput") {
+        backend = RecorderBackend::WINDOWS_GAMEINPUT;
+    }
+    else if (token == "rawinput") {
+        backend = RecorderBackend::WINDOWS_RAWINPUT;
+    }
+    else if (token == "evdev") {
+        backend = RecorderBackend::LINUX_EVDEV;
+    }
+    else if (token == "io_uring") {
+        backend = RecorderBackend::LINUX_IO_URING;
+    }
+    else if (token == "hidraw") {
+        backend = RecorderBackend::LINUX_HIDRAW;
+    }
+    else if (token == "usbmon") {
+        backend = RecorderBackend::LINUX_USBMON;
+    }
+    else {
+        in.setstate(std::ios_base::failbit);
+    }
+    return in;
+}
+
+std::istream& operator>>(std::istream& in, MouseMotion& motion) {
+    std::string token;
+    in >> token;
+
+    if (token == "off") {
+        motion = MouseMotion::OFF;
+    }
+    else if (token == "raw") {
+        motion = MouseMotion::RAW;
+    }
+    else if (token == "coalesced") {
+        motion = MouseMotion::COALESCED;
+    }
+    else {
+        in.setstate(std::ios_base::failbit);
+    }
+    return in;
+}
+
+std::istream& operator>>(std::istream& in, CaptureClock& clock) {
+    std::string token;
+    in >> token;
+
+    if (token == "monotonic") {
+        clock = CaptureClock::MONOTONIC;
+    }
+    else if (token == "boottime") {
+        clock = CaptureClock::BOOTTIME;
+    }
+    else if (token == "realtime") {
+        clock = CaptureClock::REALTIME;
+    }
+    else {
+        in.setstate(std::ios_base::failbit);
+    }
+    return in;
+}
+
 int main(int argc, char const *argv[])
 {
     std::string log_path;
     ProgramMode mode;
+    RecorderBackend backend;
+    RecorderOptions recorder_options;
+    std::vector<std::string> reader_map;
     po::options_description desc("Allowed options");
     desc.add_options()
         ("help", "produce help message")
@@ -62,6 +135,82 @@ int main(int argc, char const *argv[])
             "log-path",
             po::value<std::string>(&log_path)->default_value("log.txt"),
             "Path for the log file"
+        )
+        (
+            "backend",
+            po::value<RecorderBackend>(&backend)->default_value(RecorderBackend::AUTO, "auto"),
+            "Capture backend (auto, gameinput, rawinput, evdev, io_uring, hidraw, usbmon)"
+        )
+        (
+            "keep-report-data",
+            po::bool_switch(&recorder_options.KeepReportData),
+            "Save the raw bytes of every report, not just its timestamp (hidraw and usbmon backends only)"
+        )
+        (
+            "reader-threads",
+            po::value<unsigned>(&recorder_options.ReaderThreads)->default_value(1),
+            "Number of threads reading devices (Linux only)"
+        )
+        (
+            "reader-cpu",
+            po::value<std::vector<int>>(&recorder_options.ReaderCpus)->multitoken(),
+            "CPU to pin each reader thread to, in reader thread order. -1 leaves a thread unpinned"
+        )
+        (
+            "reader-map",
+            po::value<std::vector<std::string>>(&reader_map)->composing(),
+            "Assign a device to a reader thread, as <device id>=<thread index>. "
+            "Unassigned devices are spread across threads by hash"
+        )
+        (
+            "mouse-motion",
+            po::value<MouseMotion>(&recorder_options.Motion)->default_value(MouseMotion::OFF, "off"),
+            "Record mouse motion: off, raw (every report) or coalesced (see --motion-interval). Linux only"
+        )
+        (
+            "motion-interval",
+            po::value<std::uint32_t>(&recorder_options.MotionInterval)->default_value(1000),
+            "Microseconds of mouse motion summed up into one input in coalesced mode"
+        )
+        (
+            "realtime",
+            po::bool_switch(&recorder_options.RealTime),
+            "Run the capture threads with real-time priority, locked memory and minimal timer slack (Linux only)"
+        )
+        (
+            "realtime-priority",
+            po::value<int>(&recorder_options.RealTimePriority)->default_value(50),
+            "SCHED_FIFO priority of the capture threads in real-time mode (1-99)"
+        )
+        (
+            "clock",
+            po::value<CaptureClock>(&recorder_options.Clock)->default_value(CaptureClock::MONOTONIC, "monotonic"),
+            "Clock of the timestamps: monotonic, boottime or realtime (Linux only, usbmon always uses realtime)"
+        )
+        (
+            "clock-sample-interval",
+            po::value<std::uint32_t>(&recorder_options.ClockSampleInterval)->default_value(1000),
+            "Milliseconds between samples of all clocks, which map timestamps to wall-clock time. 0 only samples at start and stop"
+        )
+        (
+            "warm-standby",
+            po::bool_switch(&recorder_options.WarmStandby),
+            "Keep devices open and reader threads running between recordings, for instant start and stop (evdev backends only)"
+        )
+        (
+            "busy-poll",
+            po::bool_switch(&recorder_options.BusyPoll),
+            "Spin on the devices instead of sleeping until they have inputs, and record when inputs were read (evdev backend only)"
+        )
+        (
+            "busy-poll-backoff",
+            po::value<std::uint32_t>(&recorder_options.BusyPollBackoff)->default_value(0),
+            "Longest sleep in microseconds between polls of idle devices in busy poll mode, 0 never sleeps"
+        )
+        (
+            "busy-poll-cpu-share",
+            po::value<unsigned>(&recorder_options.BusyPollCpuShare)->default_value(100),
+            "Percentage of a CPU each reader may use in busy poll mode (1-100)"
         );
     po::variables_map vm;
 
@@ -73,12 +222,30 @@ int main(int argc, char const *argv[])
         std::println("Error: {}", e.what());
         return 1;
     }
+    for (auto& entry: reader_map) {
+        auto pos = entry.rfind('=');
+        unsigned index;
+        if (
+            pos == std::string::npos ||
+            std::from_chars(entry.data() + pos + 1, entry.data() + entry.size(), index).ec != std::errc{}
+        ) {
+            std::println("Error: invalid reader mapping '{}', expected <device id>=<thread index>", entry);
+            return 1;
+        }
+        recorder_options.ReaderThreadMap.emplace(entry.substr(0, pos), index);
+    }
+    if (recorder_options.BusyPoll && backend != RecorderBackend::AUTO && backend != RecorderBackend::LINUX_EVDEV) {
+        std::println("Error: --busy-poll is only supported by the evdev backend");
+        return 1;
+    }
     if (vm.count("help")) {
         std::cout << desc << "\n";
         return 0;
     }
 
     const auto injector = di::make_injector(
+        di::bind<RecorderBackend>.to(backend),
+        di::bind<RecorderOptions>.to(recorder_options),
         di::bind<spdlog::logger>.to([&]() -> std::shared_ptr<spdlog::logger> {
             auto console_sink = std::make_shared<spdlog::sinks::stderr_color_sink_mt>();
             console_sink->set_level(spdlog::level::info);
@@ -43,14 +43,193 @@ void tag_invoke(const value_from_tag &, value &j, const Device &device)
 }
 
 void tag_invoke(const value_from_tag &, value &j, const Input &input)
+{
+    auto& val = j.emplace_object();
+    // motion has no key, it's kept apart from the key inputs wherever it's written
+    if (input.Kind == InputKind::MOTION)
+    {
+        val = {
+            {"timestamp", input.Timestamp},
+            {"dx", input.DX},
+            {"dy", input.DY},
+            {"reports", input.Reports}
+        };
+    }
+    else
+    {
+        val = {
+            {"timestamp", input.Timestamp},
+            {"pressed", input.Pressed},
+            {"code", static_cast<std::underlying_type_t<decltype(input.Code)>>(input.Code)}
+        };
+    }
+    if (input.Frame)
+        val.insert_or_assign("frame", input.Frame);
+    if (input.DeviceTimestamp)
+        val.insert_or_assign("device_timestamp", input.DeviceTimestamp.value());
+    if (input.ReceiveTimestamp)
+        val.insert_or_assign("receive_timestamp", input.ReceiveTimestamp.value());
+}
+
+void tag_invoke(const value_from_tag &, value &j, const Report &report)
+{
+    auto& val = j.emplace_object() = {
+        {"timestamp", report.Timestamp},
+        {"frame", report.Frame}
+    };
+    if (report.Data.size())
+    {
+        auto& source = report.Data;
+        std::string base64(simdutf::base64_length_from_binary(source.size()), 0);
+        std::ignore = simdutf::binary_to_base64(
+            reinterpret_cast<const char*>(source.data()), source.size(),
+            base64.data()
+        );
+        val.insert_or_assign("data", base64);
+    }
+}
+
+// Gamepads report continuously, so samples are plain arrays:
+// [timestamp, frame, axis, value]
+void tag_invoke(const value_from_tag &, value &j, const AxisSample &sample)
+{
+    j.emplace_array() = {
+        sample.Timestamp,
+        sample.Frame,
+        static_cast<std::underlying_type_t<decltype(sample.Axis)>>(sample.Axis),
+        sample.Value
+    };
+}
+
+void tag_invoke(const value_from_tag &, value &j, const RealTimeStatus &status)
+{
+    j.emplace_object() = {
+        {"requested", status.Requested},
+        {"memory_locked", status.MemoryLocked},
+        {"scheduler", status.Scheduler},
+        {"timer_slack", status.TimerSlack}
+    };
+}
+
+void tag_invoke(const value_from_tag &, value &j, const ClockSample &sample)
 {
     j.emplace_object() = {
-        {"timestamp", input.Timestamp},
-        {"pressed", input.Pressed},
-        {"code", static_cast<std::underlying_type_t<decltype(input.Code)>>(input.Code)}
+        {"timestamp", sample.Timestamp},
+        {"uncertainty", sample.Uncertainty},
+        {"monotonic", sample.Monotonic},
+        {"boottime", sample.Boottime},
+        {"realtime", sample.Realtime}
     };
 }
 
+void tag_invoke(const value_from_tag &, value &j, const InputGap &gap)
+{
+    j.emplace_object() = {
+        {"start", gap.Start},
+        {"end", gap.End},
+        {"synthesized", gap.Synthesized},
+        {"resynced", gap.Resynced}
+    };
+}
+
+void tag_invoke(const value_from_tag &, value &j, const OverflowStats &stats)
+{
+    j.emplace_object() = {
+        {"drops", stats.Drops},
+        {"resyncs", stats.Resyncs},
+        {"synthesized", stats.Synthesized},
+        {"gaps", value_from(stats.Gaps)}
+    };
+}
+
+// The fields of an input that are only written when set
+static void optional_fields_from(object& val, const Recorder::InputBuffer::column_view& columns, std::size_t i)
+{
+    if (auto frame = columns.frame(i))
+        val.insert_or_assign("frame", frame);
+    if (auto timestamp = columns.device_timestamp(i))
+        val.insert_or_assign("device_timestamp", *timestamp);
+    if (auto timestamp = columns.receive_timestamp(i))
+        val.insert_or_assign("receive_timestamp", *timestamp);
+}
+
+// Only the key inputs, motion goes into its own section. Read from the
+// columns, without decoding whole inputs.
+void tag_invoke(const value_from_tag &, value &j, const Recorder::InputBuffer &inputs)
+{
+    auto& arr = j.emplace_array();
+    arr.reserve(inputs.size());
+    inputs.visit_columns([&](const Recorder::InputBuffer::column_view& columns) {
+        for (std::size_t i = 0; i < columns.size(); ++i)
+        {
+            if (columns.kind(i) != InputKind::KEY)
+                continue;
+            object val = {
+                {"timestamp", columns.timestamp(i)},
+                {"pressed", columns.pressed(i)},
+                {"code", static_cast<std::underlying_type_t<Keycode>>(columns.code(i))}
+            };
+            optional_fields_from(val, columns, i);
+            arr.push_back(std::move(val));
+        }
+    });
+}
+
+// Devices that recorded motion, by ID
+static object motion_from(const Recorder::InputMap& inputs)
+{
+    object motion;
+    inputs.cvisit_all([&](const Recorder::InputMap::value_type& device) {
+        array arr;
+        device.second->visit_columns([&](const Recorder::InputBuffer::column_view& columns) {
+            for (std::size_t i = 0; i < columns.size(); ++i)
+            {
+                if (columns.kind(i) != InputKind::MOTION)
+                    continue;
+                object val = {
+                    {"timestamp", columns.timestamp(i)},
+                    {"dx", columns.dx(i)},
+                    {"dy", columns.dy(i)},
+                    {"reports", columns.reports(i)}
+                };
+                optional_fields_from(val, columns, i);
+                arr.push_back(std::move(val));
+            }
+        });
+        if (!arr.empty())
+            motion[device.first] = std::move(arr);
+    });
+    return motion;
+}
+
+// Buffers by device handle, written by device ID. Devices that have nothing
+// in them are left out.
+template <typename Buffer>
+static object by_device_id(
+    const Recorder& recorder,
+    const boost::unordered::concurrent_flat_map<DeviceHandle, std::unique_ptr<Buffer>>& buffers
+)
+{
+    object obj;
+    buffers.cvisit_all([&](const auto& entry) {
+        auto& buffer = *entry.second;
+        if (buffer.empty())
+            return;
+        array arr;
+        arr.reserve(buffer.size());
+        for (auto& item: buffer)
+            arr.push_back(value_from(item));
+        obj[recorder.DeviceId(entry.first)] = std::move(arr);
+    });
+    return obj;
+}
+
+template <typename T>
+void tag_invoke(const value_from_tag &, value &j, const std::unique_ptr<T> &ptr)
+{
+    j = value_from(*ptr);
+}
+
 template <typename T>
 void tag_invoke(const value_from_tag &, value &j, const boost::unordered::concurrent_flat_map<std::string, T>& map)
 {
@@ -96,13 +275,34 @@ void tag_invoke(const value_from_tag &, value &j, const Recorder &recorder)
     sysInfo["backend"] =
         backend == RecorderBackend::WINDOWS_GAMEINPUT ? "gameinput" :
         backend == RecorderBackend::LINUX_EVDEV       ? "evdev"     :
+        backend == RecorderBackend::LINUX_IO_URING    ? "io_uring"  :
+        backend == RecorderBackend::LINUX_HIDRAW      ? "hidraw"    :
+        backend == RecorderBackend::LINUX_USBMON      ? "usbmon"    :
                                                         "unknown";
+    sysInfo["realtime"] = value_from(recorder.RealTime());
+    object clock = {
+        {"samples", value_from(recorder.ClockSamples())}
+    };
+    if (auto source = recorder.Clock())
+    {
+        // clang-format off
+        clock["source"] =
+            *source == CaptureClock::MONOTONIC ? "monotonic" :
+            *source == CaptureClock::BOOTTIME  ? "boottime"  :
+                                                 "realtime";
+        // clang-format on
+    }
     j.emplace_object() = {
         {"info", sysInfo},
         {"time", std::format("{:%FT%TZ}", recorder.StartTime())},
+        {"clock", clock},
         {"usb_devices", value_from(recorder.UsbDevices())},
         {"devices", value_from(recorder.Devices())},
-        {"inputs", value_from(recorder.Inputs())}
+        {"inputs", value_from(recorder.Inputs())},
+        {"motion", motion_from(recorder.Inputs())},
+        {"overflows", value_from(recorder.Overflows())},
+        {"reports", by_device_id(recorder, recorder.Reports())},
+        {"axes", by_device_id(recorder, recorder.Axes())}
     };
     // clang-format on
 }